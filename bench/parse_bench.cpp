@@ -0,0 +1,116 @@
+// Request parsing micro benchmark
+// Compares the istringstream parser parse_request used before the incremental parser with
+// the current parse_request and the zero-copy request_parser on scalar and SIMD scan kernels
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <functional>
+#include "http.hpp"
+#include "http_scan.h"
+
+// The parse_request implementation the incremental parser replaced, kept as the baseline
+static http::request legacy_parse_request(const std::string& input) {
+    http::request req;
+    std::istringstream stream(input);
+    std::string line;
+
+    if (getline(stream, line)) {
+        std::istringstream lineStream(line);
+        std::string uri;
+        lineStream >> req.method >> uri >> req.version;
+        req.uri = http::URI(uri);
+    }
+
+    while (getline(stream, line) && line != "\r") {
+        if (line.empty()) break;
+
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        size_t colonPos = line.find(':');
+        if (colonPos != std::string::npos) {
+            std::string key = line.substr(0, colonPos);
+            std::string value = line.substr(colonPos + 2);
+
+            key.erase(0, key.find_first_not_of(" \t"));
+            key.erase(key.find_last_not_of(" \t") + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            value.erase(value.find_last_not_of(" \t") + 1);
+
+            req.headers[key] = value;
+        }
+    }
+
+    std::ostringstream bodyStream;
+    bodyStream << stream.rdbuf();
+    req.body = bodyStream.str();
+
+    return req;
+}
+
+// A browser like request with about 1.5 KB of cookies and tracing headers
+static std::string make_request() {
+    std::string cookie;
+    for (int i = 0; i < 24; i++)
+        cookie += "session_part_" + std::to_string(i) + "=" + std::string(40, 'a' + i % 26) + "; ";
+
+    return "GET /products/42/reviews?page=2&sort=recent HTTP/1.1\r\n"
+           "Host: shop.example.com\r\n"
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+           "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+           "Accept-Language: en-US,en;q=0.9\r\n"
+           "Accept-Encoding: gzip, deflate, br\r\n"
+           "Connection: keep-alive\r\n"
+           "Cookie: " + cookie + "\r\n"
+           "traceparent: 00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01\r\n"
+           "tracestate: congo=t61rcWkgMzE,rojo=00f067aa0ba902b7\r\n"
+           "X-Request-Id: 5b0f2a4e-9c1d-4e4f-8a77-1f2d3c4b5a69\r\n"
+           "X-Forwarded-For: 203.0.113.195, 70.41.3.18, 150.172.238.178\r\n"
+           "Cache-Control: max-age=0\r\n"
+           "\r\n";
+}
+
+static void run(const std::string& name, int iterations, const std::function<size_t()>& f) {
+    size_t sink = 0;
+    for (int i = 0; i < iterations / 10; i++)
+        sink += f();
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        sink += f();
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count() / iterations;
+    std::cout << name << ": " << ns << " ns/request (" << sink % 10 << ")" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? std::stoi(argv[1]) : 200000;
+    const std::string input = make_request();
+    std::cout << "Request size: " << input.size() << " bytes, scan kernels: " << http::scan_kernels() << std::endl;
+
+    run("legacy parse_request", iterations, [&] {
+        return legacy_parse_request(input).headers.size();
+    });
+    run("parse_request", iterations, [&] {
+        return http::parse_request(input).headers.size();
+    });
+
+    http::request_parser parser;
+    run("request_parser (simd)", iterations, [&] {
+        parser.reset();
+        parser.parse(input);
+        return parser.request().headers.size();
+    });
+
+    http::use_scalar_scan(true);
+    run("request_parser (scalar)", iterations, [&] {
+        parser.reset();
+        parser.parse(input);
+        return parser.request().headers.size();
+    });
+
+    return 0;
+}
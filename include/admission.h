@@ -0,0 +1,60 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Adaptive limit of the requests running in the controllers at the same time (AIMD)
+// While the handlers answer within the target latency and the limit is in use, it grows by about one
+// per limit requests, a handler slower than the target cuts it by BACKOFF, at most once per target period
+// A request over the limit is shed with a 503 instead of queueing behind the slow ones
+class AdmissionControl {
+private:
+    static constexpr double BACKOFF = 0.9;
+    static constexpr int MIN_LIMIT = 1;
+
+    std::chrono::steady_clock::duration target;
+    int max_limit;
+    std::atomic<int> in_flight{0};
+    std::atomic<double> limit;
+    std::atomic<int64_t> last_decrease{0}; // steady clock ticks
+
+    void publish(double value);
+public:
+    // Starts with initial_limit concurrent requests, never goes above max_limit
+    AdmissionControl(std::chrono::steady_clock::duration target, int initial_limit, int max_limit);
+
+    // Returns false when the request must be shed, otherwise release must follow
+    bool try_acquire();
+    // Reports the handler latency of an admitted request
+    void release(std::chrono::steady_clock::duration latency);
+
+    int current_limit() const {
+        return (int)limit.load(std::memory_order_relaxed);
+    }
+
+    // Admits a request for its lifetime, always admitted without a controller
+    class ticket {
+    private:
+        AdmissionControl* control;
+        std::chrono::steady_clock::time_point start;
+        bool admitted;
+    public:
+        explicit ticket(AdmissionControl* control):
+            control(control), start(std::chrono::steady_clock::now()),
+            admitted(control == nullptr || control->try_acquire()) {}
+        ~ticket() {
+            if (control != nullptr && admitted)
+                control->release(std::chrono::steady_clock::now() - start);
+        }
+        ticket(const ticket&) = delete;
+        ticket& operator=(const ticket&) = delete;
+
+        explicit operator bool() const {
+            return admitted;
+        }
+    };
+};
+
+#endif // ADMISSION_H
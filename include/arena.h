@@ -0,0 +1,52 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+
+// Monotonic scratch memory for the objects that die with the requests being answered
+// Allocations are pointer bumps, everything is released at once when the arena is reset
+// The first INLINE_SIZE bytes never touch the heap, the resource then grows in chunks it keeps until the reset
+// Each thread has its own, reset when its outermost scope ends, a batch handed to another thread gets its own
+// instead so its requests and replies survive the hand-off (one thread at a time uses it)
+class Arena {
+private:
+    static constexpr size_t INLINE_SIZE = 16 * 1024;
+
+    alignas(std::max_align_t) char initial[INLINE_SIZE];
+    std::pmr::monotonic_buffer_resource resource;
+    int depth = 0; // open scopes of the thread's arena
+
+    static Arena& local();
+public:
+    Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Releases everything handed out, nothing allocated from the arena may be alive anymore
+    void reset() {
+        resource.release();
+    }
+
+    // Makes an arena the current one of the thread until the scope ends, scopes nest
+    // A scope must end on the thread that opened it (never across a co_await)
+    class scope {
+    private:
+        Arena& arena;
+        Arena* previous;
+        bool thread_arena; // the thread's own arena, reset when its outermost scope ends
+    public:
+        // Keeps the thread's arena alive, the memory handed out inside must not outlive the scope
+        scope();
+        // Allocates from arena inside the scope, its memory stays until arena is reset
+        explicit scope(Arena& arena);
+        ~scope();
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+    };
+
+    // The arena of the innermost scope, the default heap resource outside of any
+    static std::pmr::memory_resource* current();
+};
+
+#endif // ARENA_H
@@ -0,0 +1,62 @@
+#ifndef COARSE_CLOCK_H
+#define COARSE_CLOCK_H
+
+#include <ctime>
+#include <cstddef>
+#include <string_view>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Process wide clock with a one second resolution, a timer thread formats the strings once per second
+// Readers only load the pointer to the current stamp, started on first use
+class CoarseClock {
+public:
+    static constexpr size_t DATE_SIZE = 29; // IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT"
+    static constexpr size_t LOG_SIZE = 8;   // local HH:MM:SS
+private:
+    struct stamp {
+        time_t seconds = 0;
+        char date[DATE_SIZE + 1];
+        char log[LOG_SIZE + 1];
+    };
+
+    // A published stamp is rewritten SLOTS - 1 seconds later, the views handed out stay valid until then
+    static constexpr size_t SLOTS = 8;
+
+    stamp stamps[SLOTS];
+    size_t next = 0; // slot of the next tick, only touched by the timer thread
+    std::atomic<const stamp*> current{nullptr};
+
+    std::mutex mutex;
+    std::condition_variable stop_cv;
+    bool running = true;
+    std::thread thread;
+
+    void tick(time_t seconds);
+    void run();
+public:
+    CoarseClock();
+    ~CoarseClock();
+
+    CoarseClock(const CoarseClock&) = delete;
+    CoarseClock& operator=(const CoarseClock&) = delete;
+
+    static CoarseClock& instance();
+
+    // Seconds since the epoch of the last tick
+    time_t now() const {
+        return current.load(std::memory_order_acquire)->seconds;
+    }
+    // Value of the Date header, copy it when it must outlive a few seconds
+    std::string_view date() const {
+        return std::string_view(current.load(std::memory_order_acquire)->date, DATE_SIZE);
+    }
+    // Timestamp of the log lines, same lifetime as date
+    std::string_view log_time() const {
+        return std::string_view(current.load(std::memory_order_acquire)->log, LOG_SIZE);
+    }
+};
+
+#endif // COARSE_CLOCK_H
@@ -0,0 +1,36 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <string>
+#include <string_view>
+
+// Response compression with zlib and the Accept-Encoding negotiation
+namespace http {
+
+enum class content_coding {
+    identity,
+    gzip,
+    deflate,
+};
+
+constexpr unsigned coding_bit(content_coding coding) {
+    return 1u << (unsigned)coding;
+}
+
+// Picks the coding to answer with from an Accept-Encoding value, gzip is preferred over deflate
+// Codings with q=0 are refused, "*" stands for any coding not listed
+// available is the mask of the codings the response can be sent in, identity always is
+content_coding negotiate_encoding(std::string_view accept_encoding, unsigned available = ~0u);
+
+// Returns the Content-Encoding token of a coding
+const char* coding_name(content_coding coding);
+
+// Returns true for the text based types worth compressing
+bool compressible(std::string_view content_type);
+
+// Compresses data in the gzip or zlib (deflate) format, level goes from 1 (fastest) to 9 (smallest)
+std::string compress(std::string_view data, content_coding coding, int level = 6);
+
+}
+
+#endif // COMPRESSION_H
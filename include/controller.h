@@ -2,11 +2,67 @@
 #define CONTROLLER_H
 
 #include "http.hpp"
+#include "task.h"
+#include <array>
 #include <string>
+#include <type_traits>
+
+// Handlers the controller type T overrides among the ones of Base, Controller or AsyncController
+// Base names them through T with its aliases (get_of is &T::Get for Controller), checked from Base so the
+// private overrides of the subclasses make the expression ill-formed instead of visible: both count as overridden
+template<typename T, typename Base>
+struct overridden_handlers {
+private:
+    template<template<typename> typename Name, typename = void>
+    struct inherits : std::false_type {};
+    template<template<typename> typename Name>
+    struct inherits<Name, std::void_t<Name<T>>> : std::is_same<Name<T>, Name<Base>> {};
+
+    static constexpr unsigned bit(http::verb v) {
+        return 1u << (unsigned)v;
+    }
+
+public:
+    static constexpr bool handle = !inherits<Base::template handle_of>::value;
+    static constexpr bool get = !inherits<Base::template get_of>::value;
+    static constexpr bool post = !inherits<Base::template post_of>::value;
+    static constexpr bool put = !inherits<Base::template put_of>::value;
+    static constexpr bool patch = !inherits<Base::template patch_of>::value;
+    static constexpr bool delete_ = !inherits<Base::template delete_of>::value;
+    static constexpr bool options = !inherits<Base::template options_of>::value;
+
+    // Verbs T answers as a mask of 1 << http::verb, computed at compile time, HEAD is answered by Get
+    static constexpr unsigned verbs() {
+        if (handle)
+            return ~0u; // A custom handle decides alone
+        return (get ? bit(http::verb::get) | bit(http::verb::head) : 0) | (post ? bit(http::verb::post) : 0) |
+               (put ? bit(http::verb::put) : 0) | (patch ? bit(http::verb::patch) : 0) |
+               (delete_ ? bit(http::verb::delete_) : 0) | (options ? bit(http::verb::options) : 0);
+    }
+};
+
+// Verb table entry calling the final overrider of the virtual handler Member for self
+// Only bound for the handlers overridden_handlers found overridden, which compares the member function
+// pointer types and works on any compiler, this only decides how the overrider is reached:
+// GCC looks it up once when the controller is added so the requests call it directly,
+// elsewhere the entry makes the virtual call
+template<auto Member, typename Function, typename Self>
+Function resolve_handler(Self* self) {
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpmf-conversions"
+    return (Function)(self->*Member);
+#pragma GCC diagnostic pop
+#else
+    (void)self; // Reached through the vtable on each call instead
+    return [](Self* controller, http::request& req) { return (controller->*Member)(req); };
+#endif
+}
 
 class Controller {
 protected:
     std::string route;
+    bool async = false; // set by AsyncController, the server then awaits dispatch_async
     virtual http::response Get(http::request& req) {
         (void)req; // Used to silence the unused parameter warning at compile time
         return http::not_implemented();
@@ -31,31 +87,211 @@ protected:
         (void)req; // Used to silence the unused parameter warning at compile time
         return http::not_implemented();
     }
+
+public:
+    // Entry of the verb table, the handler the controller resolved for a verb
+    using handler = http::response (*)(Controller*, http::request&);
+
+protected:
+    // By http::verb, null for the verbs the controller doesn't answer, filled by bind_handlers
+    std::array<handler, http::VERB_COUNT> handlers{};
+
+private:
+    // The handlers for overridden_handlers, named through the subclass from here
+    template<typename, typename> friend struct overridden_handlers;
+    template<typename T> using handle_of = decltype(&T::handle);
+    template<typename T> using get_of = decltype(&T::Get);
+    template<typename T> using post_of = decltype(&T::Post);
+    template<typename T> using put_of = decltype(&T::Put);
+    template<typename T> using patch_of = decltype(&T::Patch);
+    template<typename T> using delete_of = decltype(&T::Delete);
+    template<typename T> using options_of = decltype(&T::Options);
+
 public:
+    template<typename T>
+    static constexpr unsigned handled_verbs() {
+        return overridden_handlers<T, Controller>::verbs();
+    }
+
+    // Fills the verb table from the handlers T overrides, once the controller is constructed
+    template<typename T>
+    void bind_handlers() {
+        using overrides = overridden_handlers<T, Controller>;
+        if constexpr (overrides::handle) {
+            handlers.fill(resolve_handler<&Controller::handle, handler>(this));
+            handlers[(int)http::verb::unknown] = nullptr;
+            return;
+        }
+        handlers.fill(nullptr);
+        if constexpr (overrides::get)
+            handlers[(int)http::verb::get] = handlers[(int)http::verb::head] = resolve_handler<&Controller::Get, handler>(this);
+        if constexpr (overrides::post)
+            handlers[(int)http::verb::post] = resolve_handler<&Controller::Post, handler>(this);
+        if constexpr (overrides::put)
+            handlers[(int)http::verb::put] = resolve_handler<&Controller::Put, handler>(this);
+        if constexpr (overrides::patch)
+            handlers[(int)http::verb::patch] = resolve_handler<&Controller::Patch, handler>(this);
+        if constexpr (overrides::delete_)
+            handlers[(int)http::verb::delete_] = resolve_handler<&Controller::Delete, handler>(this);
+        if constexpr (overrides::options)
+            handlers[(int)http::verb::options] = resolve_handler<&Controller::Options, handler>(this);
+    }
+
     Controller(const std::string& route): route(route) {}
     virtual ~Controller() = default;
-    std::string get_route() const {
+    const std::string& get_route() const {
         return route;
     }
+    bool is_async() const {
+        return async;
+    }
+
+    // Calls the handler of the request verb from the table, the verb has to be one of handled_verbs
+    http::response dispatch(http::request& req) {
+        return handlers[(int)req.verb](this, req);
+    }
 
     // Basic handling for the http request
     virtual http::response handle(http::request& req) {
-        if (req.method == "GET") {
+        switch (req.verb) {
+        case http::verb::get:
+        case http::verb::head:
             return Get(req);
-        } else if (req.method == "POST") {
+        case http::verb::post:
             return Post(req);
-        } else if (req.method == "PUT") {
+        case http::verb::put:
             return Put(req);
-        } else if (req.method == "PATCH") {
+        case http::verb::patch:
             return Patch(req);
-        } else if (req.method == "DELETE") {
+        case http::verb::delete_:
             return Delete(req);
-        } else if (req.method == "OPTIONS") {
+        case http::verb::options:
             return Options(req);
-        } else {
+        default:
             return http::bad_request();
         }
     }
 };
 
+// Controller whose handlers are coroutines, a handler waiting on a timer, a socket or an offloaded call
+// (see scheduler.h) gives its thread back to the server until it is resumed
+class AsyncController : public Controller {
+protected:
+    virtual async::task<http::response> GetAsync(http::request& req) {
+        (void)req;
+        co_return http::not_implemented();
+    }
+    virtual async::task<http::response> PostAsync(http::request& req) {
+        (void)req;
+        co_return http::not_implemented();
+    }
+    virtual async::task<http::response> PutAsync(http::request& req) {
+        (void)req;
+        co_return http::not_implemented();
+    }
+    virtual async::task<http::response> PatchAsync(http::request& req) {
+        (void)req;
+        co_return http::not_implemented();
+    }
+    virtual async::task<http::response> DeleteAsync(http::request& req) {
+        (void)req;
+        co_return http::not_implemented();
+    }
+    virtual async::task<http::response> OptionsAsync(http::request& req) {
+        (void)req;
+        co_return http::not_implemented();
+    }
+
+public:
+    using async_handler = async::task<http::response> (*)(AsyncController*, http::request&);
+
+protected:
+    std::array<async_handler, http::VERB_COUNT> async_handlers{};
+
+private:
+    template<typename, typename> friend struct overridden_handlers;
+    template<typename T> using handle_of = decltype(&T::handle_async);
+    template<typename T> using get_of = decltype(&T::GetAsync);
+    template<typename T> using post_of = decltype(&T::PostAsync);
+    template<typename T> using put_of = decltype(&T::PutAsync);
+    template<typename T> using patch_of = decltype(&T::PatchAsync);
+    template<typename T> using delete_of = decltype(&T::DeleteAsync);
+    template<typename T> using options_of = decltype(&T::OptionsAsync);
+
+    // Entry of the synchronous table, blocks until the coroutine is done for the threaded mode
+    static http::response wait_for(Controller* controller, http::request& req) {
+        return async::sync_wait(static_cast<AsyncController*>(controller)->dispatch_async(req));
+    }
+
+public:
+    template<typename T>
+    static constexpr unsigned handled_verbs() {
+        return overridden_handlers<T, AsyncController>::verbs();
+    }
+
+    template<typename T>
+    void bind_handlers() {
+        using overrides = overridden_handlers<T, AsyncController>;
+        if constexpr (overrides::handle) {
+            async_handlers.fill(resolve_handler<&AsyncController::handle_async, async_handler>(this));
+            async_handlers[(int)http::verb::unknown] = nullptr;
+        } else {
+            async_handlers.fill(nullptr);
+            if constexpr (overrides::get)
+                async_handlers[(int)http::verb::get] = async_handlers[(int)http::verb::head] =
+                    resolve_handler<&AsyncController::GetAsync, async_handler>(this);
+            if constexpr (overrides::post)
+                async_handlers[(int)http::verb::post] = resolve_handler<&AsyncController::PostAsync, async_handler>(this);
+            if constexpr (overrides::put)
+                async_handlers[(int)http::verb::put] = resolve_handler<&AsyncController::PutAsync, async_handler>(this);
+            if constexpr (overrides::patch)
+                async_handlers[(int)http::verb::patch] = resolve_handler<&AsyncController::PatchAsync, async_handler>(this);
+            if constexpr (overrides::delete_)
+                async_handlers[(int)http::verb::delete_] = resolve_handler<&AsyncController::DeleteAsync, async_handler>(this);
+            if constexpr (overrides::options)
+                async_handlers[(int)http::verb::options] = resolve_handler<&AsyncController::OptionsAsync, async_handler>(this);
+        }
+        for (int v = 0; v < http::VERB_COUNT; v++)
+            handlers[v] = async_handlers[v] != nullptr ? wait_for : nullptr;
+    }
+
+    AsyncController(const std::string& route): Controller(route) {
+        async = true;
+    }
+
+    virtual async::task<http::response> handle_async(http::request& req) {
+        switch (req.verb) {
+        case http::verb::get:
+        case http::verb::head:
+            return GetAsync(req);
+        case http::verb::post:
+            return PostAsync(req);
+        case http::verb::put:
+            return PutAsync(req);
+        case http::verb::patch:
+            return PatchAsync(req);
+        case http::verb::delete_:
+            return DeleteAsync(req);
+        case http::verb::options:
+            return OptionsAsync(req);
+        default:
+            return bad_request_async();
+        }
+    }
+
+    async::task<http::response> dispatch_async(http::request& req) {
+        return async_handlers[(int)req.verb](this, req);
+    }
+
+    // Blocks until the coroutine is done, for the threaded mode that has no loop to return to
+    http::response handle(http::request& req) override {
+        return async::sync_wait(handle_async(req));
+    }
+
+private:
+    static async::task<http::response> bad_request_async() {
+        co_return http::bad_request();
+    }
+};
+
 #endif // CONTROLLER_H
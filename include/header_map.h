@@ -0,0 +1,208 @@
+#ifndef HEADER_MAP_H
+#define HEADER_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <iterator>
+
+namespace http {
+
+// Well known header names, their hash is computed once at compile time
+enum class field {
+    accept_encoding,
+    allow,
+    connection,
+    content_encoding,
+    content_length,
+    content_range,
+    content_type,
+    date,
+    etag,
+    host,
+    if_modified_since,
+    if_none_match,
+    if_range,
+    last_modified,
+    location,
+    range,
+    retry_after,
+    server,
+    transfer_encoding,
+    vary,
+};
+
+constexpr int FIELD_COUNT = (int)field::vary + 1;
+
+// Canonical spelling of a well known header
+std::string_view field_name(field f);
+
+// Case insensitive FNV-1a hash of a header name
+constexpr uint32_t header_hash(std::string_view name) {
+    uint32_t hash = 2166136261u;
+    for (char c: name) {
+        if (c >= 'A' && c <= 'Z')
+            c = (char)(c + ('a' - 'A'));
+        hash = (hash ^ (unsigned char)c) * 16777619u;
+    }
+    return hash;
+}
+
+// ASCII case insensitive comparison of two header names
+bool iequals(std::string_view a, std::string_view b);
+
+// Header container of the requests and responses, used like the std::map it replaces
+// Names compare case insensitively and the entries keep their insertion order
+// The first INLINE_HEADERS entries live in the object itself, a lookup compares the stored hashes first
+// The strings and the entries past the inline ones come from the memory resource of the map, like a
+// std::pmr container a copy made without an allocator uses the default resource and a move keeps it
+class header_map {
+public:
+    using value_type = std::pair<std::pmr::string, std::pmr::string>;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+    static constexpr size_t INLINE_HEADERS = 16;
+private:
+    struct entry {
+        value_type header;
+        uint32_t hash;
+    };
+
+    std::pmr::memory_resource* resource;
+    entry* entries;
+    size_t used = 0;
+    size_t capacity = INLINE_HEADERS;
+    alignas(entry) unsigned char storage[INLINE_HEADERS * sizeof(entry)];
+
+    entry* inline_entries() {
+        return reinterpret_cast<entry*>(storage);
+    }
+    bool is_inline() const {
+        return entries == reinterpret_cast<const entry*>(storage);
+    }
+    entry* lookup(std::string_view name, uint32_t hash) const;
+    entry& append(std::string_view name, uint32_t hash);
+    void construct(entry* at, const entry& from);
+    void construct(entry* at, entry&& from);
+    void reserve(size_t wanted);
+    void release();
+    void take(header_map& other);
+public:
+    template<typename Entry, typename Value>
+    class basic_iterator {
+    private:
+        Entry* current = nullptr;
+        friend class header_map;
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = header_map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Value*;
+        using reference = Value&;
+
+        basic_iterator() = default;
+        explicit basic_iterator(Entry* current): current(current) {}
+        // iterator converts to const_iterator
+        template<typename OtherEntry, typename OtherValue>
+        basic_iterator(const basic_iterator<OtherEntry, OtherValue>& other): current(other.current) {}
+
+        reference operator*() const {
+            return current->header;
+        }
+        pointer operator->() const {
+            return &current->header;
+        }
+        basic_iterator& operator++() {
+            current++;
+            return *this;
+        }
+        basic_iterator operator++(int) {
+            basic_iterator previous = *this;
+            current++;
+            return previous;
+        }
+        template<typename OtherEntry, typename OtherValue>
+        bool operator==(const basic_iterator<OtherEntry, OtherValue>& other) const {
+            return current == other.current;
+        }
+        template<typename OtherEntry, typename OtherValue>
+        bool operator!=(const basic_iterator<OtherEntry, OtherValue>& other) const {
+            return current != other.current;
+        }
+
+        template<typename, typename>
+        friend class basic_iterator;
+    };
+
+    using iterator = basic_iterator<entry, value_type>;
+    using const_iterator = basic_iterator<const entry, const value_type>;
+
+    header_map();
+    explicit header_map(const allocator_type& alloc);
+    header_map(const header_map& other);
+    header_map(const header_map& other, const allocator_type& alloc);
+    header_map(header_map&& other) noexcept;
+    header_map(header_map&& other, const allocator_type& alloc);
+    header_map& operator=(const header_map& other);
+    header_map& operator=(header_map&& other);
+    ~header_map();
+
+    allocator_type get_allocator() const {
+        return allocator_type(resource);
+    }
+
+    iterator begin() {
+        return iterator(entries);
+    }
+    iterator end() {
+        return iterator(entries + used);
+    }
+    const_iterator begin() const {
+        return const_iterator(entries);
+    }
+    const_iterator end() const {
+        return const_iterator(entries + used);
+    }
+    size_t size() const {
+        return used;
+    }
+    bool empty() const {
+        return used == 0;
+    }
+
+    iterator find(std::string_view name);
+    const_iterator find(std::string_view name) const;
+    iterator find(field name);
+    const_iterator find(field name) const;
+    // Same as std::map::count, 0 or 1
+    size_t count(std::string_view name) const {
+        return lookup(name, header_hash(name)) != nullptr ? 1 : 0;
+    }
+    bool contains(std::string_view name) const {
+        return lookup(name, header_hash(name)) != nullptr;
+    }
+    bool contains(field name) const {
+        return find(name) != end();
+    }
+
+    // Returns the value of the header, added empty when it is missing
+    std::pmr::string& operator[](std::string_view name);
+    std::pmr::string& operator[](field name);
+    // Throws std::out_of_range when the header is missing
+    std::pmr::string& at(std::string_view name);
+    const std::pmr::string& at(std::string_view name) const;
+
+    // Adds the header unless it is already there, like std::map::emplace
+    std::pair<iterator, bool> emplace(std::string_view name, std::string_view value);
+
+    // Removes the header, returns the number of entries removed
+    size_t erase(std::string_view name);
+    iterator erase(const_iterator position);
+    void clear();
+};
+
+}
+
+#endif // HEADER_MAP_H
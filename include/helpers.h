@@ -1,9 +1,13 @@
 #ifndef HELPERS_H
 #define HELPERS_H
 
+#include <ctime>
 #include <string>
+#include <string_view>
 #include <map>
 #include <vector>
+#include <memory_resource>
+#include <sys/uio.h>
 #include <openssl/ssl.h>
 
 #define BUFFER_SIZE 16384
@@ -24,11 +28,34 @@ std::string read_to_end(int fd, int timeout = 10);
 // timeout in seconds
 std::string read_to_end(SSL* ssl, int fd, int timeout = 10);
 
+// Waits for data and appends a single read to buffer
+// returns the number of bytes read, 0 when the peer closed the connection
+// timeout in seconds
+int read_some(int fd, std::string& buffer, int timeout = 10);
+
+// Waits for data and appends a single decrypted read to buffer
+// returns the number of bytes read, 0 when the peer closed the connection
+// timeout in seconds
+int read_some(SSL* ssl, int fd, std::string& buffer, int timeout = 10);
+
+// Writes all the pieces in order, gathered with writev
+// iov is consumed as the pieces are sent
+void write_all(int fd, std::pmr::vector<iovec>& iov);
+
+// Writes all the pieces in order through the encrypted connection
+void write_all(SSL* ssl, std::pmr::vector<iovec>& iov);
+
 // returns the MIME content type
 std::string get_content_type(const std::string& filename);
 
-// returns the current time in HH:MM:SS format
-std::string get_time();
+// returns the time in the HTTP date format (IMF-fixdate), e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+std::string http_date(time_t time);
+
+// Parses an HTTP date in the IMF-fixdate format, returns false when it is malformed
+bool parse_http_date(std::string_view date, time_t& time);
+
+// returns the current time in HH:MM:SS format, read from the coarse clock
+std::string_view get_time();
 
 std::string ip_to_str(int ip);
 
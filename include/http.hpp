@@ -2,112 +2,274 @@
 #define HTTP_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <memory_resource>
 #include <nlohmann/json.hpp>
+#include "header_map.h"
+#include "arena.h"
 
 namespace http {
 
+// The URI, the request and the response take their memory from the current arena of the thread building them
+// (see arena.h), so a request answered inside an Arena::scope costs no heap allocation and dies with it
+// They follow the std::pmr containers: a move keeps the resource, a copy without an allocator is on the heap
 class URI {
 public:
-    std::vector<std::string> route;
-    std::map<std::string, std::string> parameters;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
 
-    URI();
-    URI(const std::string& uriString);
+    std::pmr::vector<std::pmr::string> route;
+    std::pmr::map<std::pmr::string, std::pmr::string> parameters;
+
+    URI(): URI(allocator_type(Arena::current())) {}
+    explicit URI(const allocator_type& alloc);
+    explicit URI(std::string_view uri, const allocator_type& alloc = allocator_type(Arena::current()));
+    URI(const URI& other) = default;
+    URI(const URI& other, const allocator_type& alloc);
+    URI(URI&& other) = default;
+    URI(URI&& other, const allocator_type& alloc);
+    URI& operator=(const URI& other) = default;
+    URI& operator=(URI&& other) = default;
+};
+
+// Request methods, the parser maps the method token once so dispatch never compares strings
+enum class verb {
+    unknown,
+    get,
+    head,
+    post,
+    put,
+    patch,
+    delete_,
+    options,
+    connect,
+    trace,
 };
 
+constexpr int VERB_COUNT = (int)verb::trace + 1;
+
+// Returns the verb of a method token, verb::unknown when it isn't a standard method
+verb parse_verb(std::string_view method);
+// Returns the method token of a verb, an empty view for verb::unknown
+std::string_view verb_name(verb v);
+
 struct request {
-    std::string method;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    std::pmr::string method;
+    http::verb verb = http::verb::unknown;
     URI uri;
-    std::string version = "HTTP/1.1";
-    std::map<std::string, std::string> headers;
-    std::string body;
+    std::pmr::string version;
+    header_map headers;
+    std::pmr::string body;
+    std::pmr::map<std::pmr::string, std::pmr::string> path_params; // segments captured by the matched route, e.g. "id" for "users/:id"
+    std::string_view route; // pattern of the matched route, owned by its controller, empty when none matched
+
+    request(): request(allocator_type(Arena::current())) {}
+    explicit request(const allocator_type& alloc);
+    request(const request& other) = default;
+    request(const request& other, const allocator_type& alloc);
+    request(request&& other) = default;
+    request(request&& other, const allocator_type& alloc);
+    request& operator=(const request& other) = default;
+    request& operator=(request&& other) = default;
+
+    allocator_type get_allocator() const {
+        return body.get_allocator();
+    }
 };
 
 struct response {
-    std::string version = "HTTP/1.1";
-    int status_code;
-    std::string status_message;
-    std::map<std::string, std::string> headers;
-    std::string body;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    std::pmr::string version;
+    int status_code = 0;
+    std::pmr::string status_message;
+    header_map headers;
+    std::string body; // on the heap, it is moved as is into the reply that may outlive the arena
+
+    response(): response(allocator_type(Arena::current())) {}
+    explicit response(const allocator_type& alloc);
+
+    allocator_type get_allocator() const {
+        return status_message.get_allocator();
+    }
+};
+
+// Header spans pointing into the receive buffer
+struct header_view {
+    std::string_view name;
+    std::string_view value;
+};
+
+// Request spans pointing into the receive buffer, valid until the buffer is modified
+struct request_view {
+    std::string_view method;
+    http::verb verb = http::verb::unknown;
+    std::string_view target;
+    std::string_view version;
+    std::vector<header_view> headers;
+    std::string_view body;
+    size_t size = 0; // bytes of the buffer taken by the whole request
+
+    // Case insensitive lookup, returns an empty view when the header is missing
+    std::string_view header(std::string_view name) const;
+
+    // Copies the spans into an owning request for the controllers, allocated with alloc
+    request to_request(const request::allocator_type& alloc = request::allocator_type(Arena::current())) const;
+};
+
+enum class parse_status {
+    complete,  // a whole request sits at the beginning of the buffer
+    need_more, // the buffer ends in the middle of a request
+    error,     // the request is malformed
+    too_large, // the body is bigger than MAX_BODY_SIZE
+};
+
+// Incremental HTTP/1.1 request parser working directly on the receive buffer
+// The buffer may grow between calls, the scan resumes where the previous call stopped
+// Only offsets are kept while parsing, so the buffer is free to reallocate
+// The body is framed by Content-Length or decoded from Transfer-Encoding: chunked, the bytes
+// after the request are left untouched for the next pipelined request
+class request_parser {
+private:
+    struct span {
+        size_t offset = 0;
+        size_t length = 0;
+    };
+
+    enum class stage {
+        request_line,
+        headers,
+        body,       // Content-Length framed body
+        chunk_size, // chunked body, size line of the next chunk
+        chunk_data,
+        chunk_end,  // CRLF closing a chunk
+        trailers,
+        done,
+    };
+
+    stage current = stage::request_line;
+    size_t start = 0; // first byte of the request, leading empty lines are skipped
+    size_t position = 0; // first byte not scanned yet
+    span method;
+    span target;
+    span version;
+    std::vector<std::pair<span, span>> headers;
+    size_t body_start = 0;
+    size_t content_length = 0;
+    bool has_content_length = false;
+    bool chunked = false;
+    size_t chunk_remaining = 0;
+    std::string decoded_body; // chunked bodies are not contiguous in the buffer
+
+    request_view view;
+
+    parse_status parse_header(std::string_view name, std::string_view value);
+    parse_status parse_chunked(std::string_view buffer);
+    void build_view(std::string_view buffer, std::string_view body, size_t size);
+public:
+    static constexpr size_t MAX_HEAD_SIZE = 65536; // request line and headers
+    static constexpr size_t MAX_BODY_SIZE = 67108864; // 64 MB
+
+    parse_status parse(std::string_view buffer);
+    // Called when no more bytes will come, a truncated body is accepted as is
+    parse_status finish(std::string_view buffer);
+
+    // The parsed request, only valid after parse returned parse_status::complete
+    const request_view& request() const {
+        return view;
+    }
+
+    // Prepares the parser for the next request, the caller drops request().size bytes from the buffer
+    void reset();
 };
 
 request parse_request(const std::string& input);
 
-std::string serialize_response(response& res);
+// Appends the status line, the headers and the Content-Length of the body to out, res is left untouched
+// The caller owns out and may clear it between responses to keep its capacity
+void serialize_head(const response& res, std::string& out);
+// Appends the whole response to out
+void serialize_response(const response& res, std::string& out);
+std::string serialize_response(const response& res);
 
 response ok();
 response ok(const nlohmann::json& body);
-response ok(const std::string& content_type, const std::string& body);
+response ok(std::string_view content_type, std::string_view body);
 
 response created();
 response created(const nlohmann::json& body);
-response created(const std::string& content_type, const std::string& body);
+response created(std::string_view content_type, std::string_view body);
 
 response accepted();
 response accepted(const nlohmann::json& body);
-response accepted(const std::string& content_type, const std::string& body);
+response accepted(std::string_view content_type, std::string_view body);
 
 response no_content();
 
-response moved_permanently(const std::string& location);
-response found(const std::string& location);
+response moved_permanently(std::string_view location);
+response found(std::string_view location);
 response not_modified();
-response temporary_redirect(const std::string& location);
-response permanent_redirect(const std::string& location);
+response temporary_redirect(std::string_view location);
+response permanent_redirect(std::string_view location);
 
 response bad_request();
 response bad_request(const nlohmann::json& body);
-response bad_request(const std::string& content_type, const std::string& body);
+response bad_request(std::string_view content_type, std::string_view body);
 
 response unauthorized();
 response unauthorized(const nlohmann::json& body);
-response unauthorized(const std::string& content_type, const std::string& body);
+response unauthorized(std::string_view content_type, std::string_view body);
 
 response forbidden();
 response forbidden(const nlohmann::json& body);
-response forbidden(const std::string& content_type, const std::string& body);
+response forbidden(std::string_view content_type, std::string_view body);
 
 response not_found();
 response not_found(const nlohmann::json& body);
-response not_found(const std::string& content_type, const std::string& body);
+response not_found(std::string_view content_type, std::string_view body);
 
 response method_not_allowed();
 response method_not_allowed(const nlohmann::json& body);
-response method_not_allowed(const std::string& content_type, const std::string& body);
+response method_not_allowed(std::string_view content_type, std::string_view body);
 
 response conflict();
 response conflict(const nlohmann::json& body);
-response conflict(const std::string& content_type, const std::string& body);
+response conflict(std::string_view content_type, std::string_view body);
+
+response payload_too_large();
+response payload_too_large(const nlohmann::json& body);
+response payload_too_large(std::string_view content_type, std::string_view body);
 
 response unprocessable_entity();
 response unprocessable_entity(const nlohmann::json& body);
-response unprocessable_entity(const std::string& content_type, const std::string& body);
+response unprocessable_entity(std::string_view content_type, std::string_view body);
 
 response too_many_requests();
 response too_many_requests(const nlohmann::json& body);
-response too_many_requests(const std::string& content_type, const std::string& body);
+response too_many_requests(std::string_view content_type, std::string_view body);
 
 response internal_server_error();
 response internal_server_error(const nlohmann::json& body);
-response internal_server_error(const std::string& content_type, const std::string& body);
+response internal_server_error(std::string_view content_type, std::string_view body);
 
 response not_implemented();
 response not_implemented(const nlohmann::json& body);
-response not_implemented(const std::string& content_type, const std::string& body);
+response not_implemented(std::string_view content_type, std::string_view body);
 
 response bad_gateway();
 response bad_gateway(const nlohmann::json& body);
-response bad_gateway(const std::string& content_type, const std::string& body);
+response bad_gateway(std::string_view content_type, std::string_view body);
 
 response service_unavailable();
 response service_unavailable(const nlohmann::json& body);
-response service_unavailable(const std::string& content_type, const std::string& body);
+response service_unavailable(std::string_view content_type, std::string_view body);
 
 response gateway_timeout();
 response gateway_timeout(const nlohmann::json& body);
-response gateway_timeout(const std::string& content_type, const std::string& body);
+response gateway_timeout(std::string_view content_type, std::string_view body);
 
 }
 
@@ -0,0 +1,23 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+// Delimiter scanning kernels used by the request parser
+// AVX2 or SSE4.2 versions are picked at startup from CPUID, with a scalar fallback
+
+namespace http {
+
+// Returns a pointer to the first byte equal to c in [begin, end), or end when there is none
+const char* find_char(const char* begin, const char* end, char c);
+
+// Returns a pointer to the first byte equal to a or b in [begin, end), or end when there is none
+const char* find_any(const char* begin, const char* end, char a, char b);
+
+// Returns the name of the kernels in use: "avx2", "sse4.2" or "scalar"
+const char* scan_kernels();
+
+// Forces the scalar kernels, used by the benchmark to compare both paths
+void use_scalar_scan(bool scalar);
+
+}
+
+#endif // HTTP_SCAN_H
@@ -0,0 +1,134 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include "coarse_clock.h"
+
+enum class log_level : uint8_t {
+    debug,   // connections opening and closing
+    info,    // one access record per answered request
+    warning, // rejected requests and failing clients
+    error,   // failures of the server itself
+    off,
+};
+
+enum class log_event : uint8_t {
+    connected,
+    disconnected,
+    access,
+    malformed,  // the parser rejected the request
+    too_large,
+    tls_failed, // the TLS handshake failed
+    client_error,
+    message,    // free text
+};
+
+// Fixed size record copied into the ring, the text is formatted by the writer thread
+struct log_record {
+    static constexpr size_t IP_SIZE = 16;
+    static constexpr size_t METHOD_SIZE = 8;
+    static constexpr size_t TEXT_SIZE = 80; // route of an access, or the message, truncated
+
+    char time[CoarseClock::LOG_SIZE]; // CoarseClock::log_time when the record was pushed
+    uint32_t latency_us;
+    uint32_t bytes;
+    uint16_t status;
+    log_event event;
+    log_level level;
+    uint8_t ip_size;
+    uint8_t method_size;
+    uint8_t text_size;
+    char ip[IP_SIZE];
+    char method[METHOD_SIZE];
+    char text[TEXT_SIZE];
+};
+
+// Process wide asynchronous logger, started on first use
+// Each thread pushes its records to its own single producer ring, nothing is locked or flushed on the way
+// A background thread drains the rings and writes the formatted lines with one write per pass
+// A record that finds its ring full is dropped and counted, the server never waits for the log
+class Logger {
+private:
+    static constexpr size_t RING_SIZE = 1024; // records per thread, a power of two
+    static constexpr std::chrono::milliseconds DRAIN_INTERVAL{10};
+
+    struct ring {
+        log_record records[RING_SIZE];
+        alignas(64) std::atomic<size_t> head{0}; // next record written, by the producer only
+        alignas(64) std::atomic<size_t> tail{0}; // next record read, by the writer only
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> retired{false}; // its thread is gone, freed once drained
+    };
+
+    // Ring and sampling counter of the calling thread
+    struct producer {
+        std::shared_ptr<ring> queue;
+        uint64_t sampled = 0;
+        ~producer();
+    };
+
+    std::atomic<log_level> level{log_level::debug};
+    std::atomic<unsigned> sample_every{1};
+
+    std::mutex mutex; // guards everything below
+    std::condition_variable wake_cv;
+    std::condition_variable drained_cv;
+    std::vector<std::shared_ptr<ring>> rings;
+    int fd = 1; // stdout unless a file is set
+    bool running = true;
+    uint64_t passes = 0;
+    std::thread thread;
+
+    // Only touched by the writer thread
+    std::string buffer;
+
+    static producer& local();
+    ring& local_ring();
+    void push(const log_record& record);
+    void format(const log_record& record);
+    void drain();
+    void run();
+public:
+    Logger();
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    static Logger& instance();
+
+    // Records below level are dropped before being queued
+    void use_level(log_level min_level);
+    // Keeps one access and connection record out of every, per thread, warnings and errors are all kept
+    void use_sampling(unsigned every);
+    // Appends the lines to the file at path, or writes them to stdout when path is empty
+    // Throws std::runtime_error when the file can't be opened
+    void use_output(const std::string& path);
+
+    bool enabled(log_level record_level) const {
+        return record_level >= level.load(std::memory_order_relaxed);
+    }
+
+    // A connection event, text is an optional detail
+    void log(log_level record_level, log_event event, std::string_view ip, std::string_view text = {});
+    // A free text line
+    void message(log_level record_level, std::string_view text);
+    // An answered request
+    void access(std::string_view ip, std::string_view method, std::string_view route, int status, size_t bytes,
+                std::chrono::steady_clock::duration latency);
+
+    // Blocks until the records pushed before the call are written
+    void flush();
+};
+
+#endif // LOGGER_H
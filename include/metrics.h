@@ -0,0 +1,151 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include "controller.h"
+
+// Latency distribution with the HDR layout: every power of two of microseconds is split in
+// SUB_BUCKETS linear buckets, so a value is known within 1 / SUB_BUCKETS (12.5%) from 1 us to an hour
+struct latency_histogram {
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int BUCKETS = (32 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS; // up to 2^32 us
+
+    // Written by the thread owning the shard only, read by the exposition
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum_us{0};
+
+    static int bucket(uint64_t us);
+    // Highest value counted in the bucket, in microseconds
+    static uint64_t upper_bound(int bucket);
+
+    void record(uint64_t us);
+};
+
+// Process wide metrics of the server, exposed in the Prometheus text format
+// Each thread records in its own shard without locking or atomic read-modify-write,
+// the exposition sums the shards, shards of exited threads are folded into the totals
+class Metrics {
+private:
+    // One latency series, keyed by route and status
+    struct series {
+        std::atomic<latency_histogram*> histogram{nullptr}; // published after the key
+        std::string route;
+        int status = 0;
+    };
+
+    struct shard {
+        static constexpr size_t SERIES = 128; // open addressing, the last slot takes the overflow
+
+        series table[SERIES];
+        std::atomic<uint64_t> bytes_in{0};
+        std::atomic<uint64_t> bytes_out{0};
+        std::atomic<uint64_t> parse_errors{0};
+        std::atomic<uint64_t> tls_failures{0};
+        std::atomic<uint64_t> connections_opened{0};
+        std::atomic<uint64_t> connections_closed{0};
+        std::atomic<uint64_t> connections_shed{0};
+        std::atomic<uint64_t> requests_shed{0};
+        std::atomic<bool> retired{false}; // its thread is gone
+
+        ~shard();
+        latency_histogram& find(std::string_view route, int status);
+    };
+
+    struct owner {
+        std::shared_ptr<shard> data;
+        ~owner();
+    };
+
+    // Plain copy of the histograms and counters, what the exposition formats
+    struct totals {
+        struct counts {
+            uint64_t buckets[latency_histogram::BUCKETS] = {};
+            uint64_t count = 0;
+            uint64_t sum_us = 0;
+        };
+        std::map<std::pair<std::string, int>, counts> latencies;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+        uint64_t parse_errors = 0;
+        uint64_t tls_failures = 0;
+        uint64_t connections_opened = 0;
+        uint64_t connections_closed = 0;
+        uint64_t connections_shed = 0;
+        uint64_t requests_shed = 0;
+
+        void add(const shard& s);
+    };
+
+    mutable std::mutex mutex; // guards shards and retired
+    std::vector<std::shared_ptr<shard>> shards;
+    totals retired; // what the exited threads recorded
+    std::atomic<int> limit{-1}; // concurrency limit of the admission control, -1 without one
+
+    static owner& local_owner();
+    shard& local();
+    void fold_retired();
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+public:
+    static Metrics& instance();
+
+    // An answered request, route is the pattern of its controller
+    void request(std::string_view route, int status, std::chrono::steady_clock::duration latency);
+    void received(size_t bytes) {
+        add(local().bytes_in, bytes);
+    }
+    void sent(size_t bytes) {
+        add(local().bytes_out, bytes);
+    }
+    void parse_error() {
+        add(local().parse_errors, 1);
+    }
+    void tls_failure() {
+        add(local().tls_failures, 1);
+    }
+    void connection_opened() {
+        add(local().connections_opened, 1);
+    }
+    void connection_closed() {
+        add(local().connections_closed, 1);
+    }
+    // Connections and requests refused with a 503 by the load shedding
+    void connection_shed() {
+        add(local().connections_shed, 1);
+    }
+    void request_shed() {
+        add(local().requests_shed, 1);
+    }
+    void concurrency_limit(int value) {
+        limit.store(value, std::memory_order_relaxed);
+    }
+
+    // Everything recorded so far in the Prometheus text format (version 0.0.4)
+    std::string expose();
+};
+
+// Serves the exposition of the metrics, added by Server::use_metrics
+class MetricsController : public Controller {
+protected:
+    http::response Get(http::request& req) override {
+        (void)req;
+        return http::ok("text/plain; version=0.0.4; charset=utf-8", Metrics::instance().expose());
+    }
+public:
+    MetricsController(const std::string& route): Controller(route) {}
+};
+
+#endif // METRICS_H
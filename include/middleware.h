@@ -0,0 +1,68 @@
+#ifndef MIDDLEWARE_H
+#define MIDDLEWARE_H
+
+#include "http.hpp"
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+
+// Base of the middlewares, a middleware hides before and/or after with its own versions
+// The calls are resolved at compile time by the chain, so nothing here is virtual
+// One instance is shared by all the threads of the server, per request state belongs in the request
+class Middleware {
+public:
+    // Runs before the routing, returning false stops the chain and sends res, which it must fill
+    bool before(http::request& req, http::response& res) {
+        (void)req;
+        (void)res;
+        return true;
+    }
+    // Runs after the controller in the reverse order, for every middleware whose before ran
+    void after(http::request& req, http::response& res) {
+        (void)req;
+        (void)res;
+    }
+};
+
+// Type erased chain stored by the server, two indirect calls per request whatever the number of middlewares
+class middleware_chain {
+public:
+    virtual ~middleware_chain() {}
+    // Returns true when every middleware let the request through, ran is the number of befores called
+    virtual bool before(http::request& req, http::response& res, size_t& ran) = 0;
+    virtual void after(http::request& req, http::response& res, size_t ran) = 0;
+};
+
+// Chain of the middlewares Types, in order, held by value
+template<typename... Types>
+class MiddlewareChain : public middleware_chain {
+    static_assert((std::is_base_of<Middleware, Types>::value && ...),
+                  "Template parameters must be derived from the Middleware class");
+private:
+    std::tuple<Types...> middlewares;
+
+    template<size_t... I>
+    bool before_all(http::request& req, http::response& res, size_t& ran, std::index_sequence<I...>) {
+        ran = 0;
+        return ((++ran, std::get<I>(middlewares).before(req, res)) && ...);
+    }
+
+    template<size_t I>
+    void after_from(http::request& req, http::response& res, size_t ran) {
+        if constexpr (I > 0) {
+            if (I - 1 < ran)
+                std::get<I - 1>(middlewares).after(req, res);
+            after_from<I - 1>(req, res, ran);
+        }
+    }
+public:
+    bool before(http::request& req, http::response& res, size_t& ran) override {
+        return before_all(req, res, ran, std::index_sequence_for<Types...>{});
+    }
+    void after(http::request& req, http::response& res, size_t ran) override {
+        after_from<sizeof...(Types)>(req, res, ran);
+    }
+};
+
+#endif // MIDDLEWARE_H
@@ -0,0 +1,62 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory_resource>
+#include <unordered_map>
+
+class Controller;
+
+// Maps request paths to controllers with a trie of path segments, built as the controllers are added
+// A route is a pattern such as "users/:id/orders" where ":name" segments capture the request segment
+// A controller owns the whole subtree under its route, the deepest matching route wins
+// and a static segment wins over a capture at the same depth
+// Each add compiles the trie into an automaton whose states are the sets of trie nodes a path can be at,
+// a lookup takes one transition per segment and never backtracks, O(path depth)
+class Router {
+private:
+    // Hashes the segments as views, the request segments are looked up without a copy
+    struct segment_hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view segment) const {
+            return std::hash<std::string_view>()(segment);
+        }
+    };
+    using segment_map = std::unordered_map<std::string, int, segment_hash, std::equal_to<>>;
+
+    struct node {
+        segment_map children; // static segments, by index in nodes
+        int capture = -1; // child matching any segment
+        Controller* controller = nullptr;
+        unsigned verbs = 0; // mask of 1 << http::verb the controller answers
+        std::vector<std::string> capture_names; // names of the captures along the route ending here
+        std::vector<size_t> capture_depths;     // and the path segment each of them takes
+    };
+
+    struct state {
+        segment_map next; // by segment, index in states
+        int other = -1;   // any other segment, only the captures take it, -1 when nothing does
+        int route = -1;   // node of the preferred route ending in this state, -1 when none does
+    };
+
+    std::vector<node> nodes; // nodes[0] is the root
+    std::vector<state> states; // states[0] starts at the root
+
+    void compile();
+public:
+    Router();
+
+    // Adds a route answering the verbs of the mask, a route added twice keeps the last controller
+    void add(const std::string& route, Controller* controller, unsigned verbs = ~0u);
+    void clear();
+
+    // Returns the controller of the route matching path, nullptr when there is none
+    // The captured segments are stored in params by name and the verbs mask of the route in verbs
+    Controller* match(const std::pmr::vector<std::pmr::string>& path,
+                      std::pmr::map<std::pmr::string, std::pmr::string>& params, unsigned& verbs) const;
+};
+
+#endif // ROUTER_H
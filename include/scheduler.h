@@ -0,0 +1,175 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "task.h"
+#include "thread_pool.h"
+
+// Resumes the suspended coroutines when their timer expires or their file descriptor is ready
+// One epoll thread serves the whole process, started on first use
+class Scheduler {
+private:
+    struct timer {
+        std::chrono::steady_clock::time_point deadline;
+        std::coroutine_handle<> handle;
+
+        bool operator>(const timer& other) const {
+            return deadline > other.deadline;
+        }
+    };
+
+    int epoll_fd = -1;
+    int wake_fd = -1; // eventfd, interrupts the wait when an earlier timer is added or on shutdown
+    std::atomic<bool> running{true};
+    std::thread thread;
+
+    std::mutex timers_mutex;
+    std::priority_queue<timer, std::vector<timer>, std::greater<timer>> timers;
+
+    std::once_flag blocking_once;
+    std::unique_ptr<ThreadPool> blocking; // runs the offloaded blocking calls
+
+    void run();
+public:
+    Scheduler();
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    static Scheduler& instance();
+
+    // Resumes handle on the scheduler thread once deadline has passed
+    void resume_at(std::chrono::steady_clock::time_point deadline, std::coroutine_handle<> handle);
+    // Resumes handle on the scheduler thread once fd reports one of the epoll events
+    // Only one coroutine may wait on a given fd at a time, returns false with errno set when fd can't be polled
+    bool resume_on(int fd, uint32_t events, std::coroutine_handle<> handle);
+    // Pool running the offloaded calls, one worker per core
+    ThreadPool& pool();
+};
+
+namespace async {
+
+struct sleep_awaiter {
+    std::chrono::steady_clock::time_point deadline;
+
+    bool await_ready() const noexcept {
+        return deadline <= std::chrono::steady_clock::now();
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+        Scheduler::instance().resume_at(deadline, handle);
+    }
+    void await_resume() noexcept {}
+};
+
+struct fd_awaiter {
+    int fd;
+    uint32_t events;
+    int error = 0;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    bool await_suspend(std::coroutine_handle<> handle) {
+        // Once registered the coroutine may already run on the scheduler thread, this must not be touched
+        if (Scheduler::instance().resume_on(fd, events, handle))
+            return true;
+        error = errno;
+        return false;
+    }
+    // Returns false with errno set when the fd couldn't be waited on
+    bool await_resume() const noexcept {
+        if (error != 0) {
+            errno = error;
+            return false;
+        }
+        return true;
+    }
+};
+
+// Runs f on a thread pool, the awaiting coroutine resumes on that worker with the result
+template<typename F>
+class offload_awaiter {
+private:
+    using result_type = std::invoke_result_t<F&>;
+    using stored_type = std::conditional_t<std::is_void<result_type>::value, bool, result_type>;
+
+    ThreadPool& pool;
+    F call;
+    std::optional<stored_type> value;
+    std::exception_ptr error;
+public:
+    offload_awaiter(ThreadPool& pool, F call): pool(pool), call(std::move(call)) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+        pool.submit([this, handle]() {
+            try {
+                if constexpr (std::is_void<result_type>::value) {
+                    call();
+                    value.emplace(true);
+                } else {
+                    value.emplace(call());
+                }
+            } catch (...) {
+                error = std::current_exception();
+            }
+            handle.resume();
+        });
+    }
+    result_type await_resume() {
+        if (error)
+            std::rethrow_exception(error);
+        if constexpr (!std::is_void<result_type>::value)
+            return std::move(*value);
+    }
+};
+
+template<typename Rep, typename Period>
+sleep_awaiter sleep_for(std::chrono::duration<Rep, Period> duration) {
+    return {std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration)};
+}
+
+// Waits until fd can be read or written, fd must be non blocking
+inline fd_awaiter readable(int fd) {
+    return {fd, EPOLLIN | EPOLLRDHUP};
+}
+inline fd_awaiter writable(int fd) {
+    return {fd, EPOLLOUT};
+}
+
+// Socket I/O on a non blocking fd, with the return values and errno of the system calls
+task<ssize_t> read(int fd, void* buffer, size_t size);
+task<ssize_t> write(int fd, const void* buffer, size_t size); // writes everything unless it fails
+task<int> connect(int fd, const sockaddr* address, socklen_t length);
+
+// Blocking calls (disk reads, Table lookups loading frames, ...) run on the pool of the scheduler,
+// or on the given pool, instead of the thread of the coroutine
+template<typename F>
+offload_awaiter<F> offload(F call) {
+    return offload_awaiter<F>(Scheduler::instance().pool(), std::move(call));
+}
+template<typename F>
+offload_awaiter<F> offload(ThreadPool& pool, F call) {
+    return offload_awaiter<F>(pool, std::move(call));
+}
+
+}
+
+#endif // SCHEDULER_H
@@ -2,16 +2,44 @@
 #define SERVER_H
 
 #include <string>
+#include <string_view>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <vector>
 #include <iostream>
 #include <list>
 #include <map>
+#include <unordered_map>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <ctime>
+#include <cstdint>
+#include <cstring>
 #include <openssl/ssl.h>
 #include "controller.h"
+#include "middleware.h"
+#include "thread_pool.h"
+#include "uring.h"
+#include "static_files.h"
+#include "router.h"
+#include "arena.h"
+#include "coarse_clock.h"
+#include "logger.h"
+#include "metrics.h"
+#include "admission.h"
+
+// Selects how the server drives its sockets
+enum class io_mode {
+    threaded, // one blocking thread per connection, taken from max_connections threads started with the loop
+    epoll,    // edge-triggered epoll reactor, all connections multiplexed on a fixed set of threads
+    sharded,  // epoll reactors pinned to cores, each accepting on its own SO_REUSEPORT listener
+    io_uring, // completion based io_uring rings, no https support
+};
 
 struct connection {
     int fd;
@@ -21,32 +49,253 @@ struct connection {
 class Server
 {
 private:
+    // Serialized response waiting to be sent
+    // A static file response borrows its head and body from the cache instead of copying them
+    struct reply {
+        std::string data; // owned bytes, the serialized head of a controller response
+        std::string content; // owned body of a controller response, moved out of it and never copied
+        std::shared_ptr<const static_asset> asset; // keeps the borrowed bytes alive
+        std::string_view head;
+        std::string_view body;
+        // multipart/byteranges, each owned part header is followed by its borrowed slice
+        std::vector<std::pair<std::string, std::string_view>> parts;
+        // "Date: ...\r\n\r\n" ending the borrowed head, sent in place of its blank line
+        char date_line[CoarseClock::DATE_SIZE + 10];
+        size_t date_size = 0;
+        int status = 0; // status code, for the access log
+
+        // Adds the Date header to the borrowed head, copied since the head may wait for a slow client
+        void set_date(std::string_view date) {
+            std::memcpy(date_line, "Date: ", 6);
+            std::memcpy(date_line + 6, date.data(), date.size());
+            std::memcpy(date_line + 6 + date.size(), "\r\n\r\n", 4);
+            date_size = date.size() + 10;
+        }
+
+        // Number of bytes sent
+        size_t size() const {
+            size_t total = data.size() + content.size() + body.size();
+            if (!head.empty())
+                total += date_size > 0 ? head.size() - 2 + date_size : head.size();
+            for (const auto& part: parts)
+                total += part.first.size() + part.second.size();
+            return total;
+        }
+
+        // Appends the pieces to send, in order
+        void gather(std::pmr::vector<iovec>& iov) const {
+            if (!data.empty())
+                iov.push_back({(void*)data.data(), data.size()});
+            if (!content.empty())
+                iov.push_back({(void*)content.data(), content.size()});
+            if (!head.empty() && date_size > 0) {
+                iov.push_back({(void*)head.data(), head.size() - 2});
+                iov.push_back({(void*)date_line, date_size});
+            } else if (!head.empty()) {
+                iov.push_back({(void*)head.data(), head.size()});
+            }
+            if (!body.empty())
+                iov.push_back({(void*)body.data(), body.size()});
+            for (const auto& part: parts) {
+                if (!part.first.empty())
+                    iov.push_back({(void*)part.first.data(), part.first.size()});
+                if (!part.second.empty())
+                    iov.push_back({(void*)part.second.data(), part.second.size()});
+            }
+        }
+    };
+
+    // State of a single connection owned by an epoll event loop
+    struct client_state {
+        enum class phase {
+            handshake, // waiting for the TLS handshake to finish
+            reading,   // collecting the request bytes
+            processing, // the request is running on the worker pool
+            writing,   // flushing the response
+            closing,   // io_uring only, the close is submitted and the connection waits for it
+        };
+
+        int fd;
+        uint64_t id; // unique per connection, tells a reused fd apart when a late event or worker reports back
+        SSL* ssl = nullptr;
+        std::string ip;
+        phase state = phase::reading;
+        std::string input;
+        http::request_parser parser; // resumes on input as more bytes arrive
+        std::pmr::vector<reply> output;     // responses being sent
+        std::pmr::vector<iovec> output_iov; // their pieces, sent front to back
+        size_t output_index = 0;       // first piece of output_iov not fully sent
+        msghdr output_msg{};           // io_uring only, describes output_iov to the in flight send
+        bool keep_alive = false;
+        bool peer_closed = false;
+        time_t last_active = 0;
+    };
+
+    // Response produced by a worker for a connection of an event loop
+    // The batch and its replies live in the arena that goes along with them, declared first so it goes last
+    struct completion {
+        uint64_t id = 0;
+        std::unique_ptr<Arena> arena;
+        std::pmr::vector<http::request> batch{};
+        std::pmr::vector<reply> output{};
+        bool keep_alive = false;
+        bool failed = false;
+    };
+
+    // One reactor thread with its own epoll instance (or io_uring ring) and the connections it owns
+    // clients is only touched by the loop thread so it needs no lock
+    struct event_loop {
+        int listen_fd = -1; // the shared server socket, or the shard's own listener in io_mode::sharded
+        int epoll_fd = -1;
+        std::unique_ptr<IoUring> ring;
+        int wake_fd = -1; // eventfd used to interrupt the loop on terminate and when workers finish
+        uint64_t wake_value = 0; // read target of the wake up event in io_uring mode
+        std::thread thread;
+        std::unordered_map<uint64_t, std::unique_ptr<client_state>> clients; // by connection id
+
+        std::mutex completed_mutex;
+        std::vector<completion> completed; // filled by the workers, drained by the loop thread
+        std::vector<std::unique_ptr<Arena>> arenas; // spare batch arenas, only touched by the loop thread
+    };
+
+    static constexpr int CLIENT_TIMEOUT_S = 10; // Idle keep-alive time in seconds before a reactor drops a client
+    static constexpr size_t MAX_PIPELINE_DEPTH = 64; // Pipelined requests answered per batch
+    static constexpr size_t MAX_SPARE_ARENAS = 64; // Batch arenas an event loop keeps for the next batches
+    static constexpr size_t MAX_RANGES = 16; // Ranges of a request before it is answered with the whole file
+    // Input buffered from a client before it is parsed, the largest request the parser accepts
+    static constexpr size_t MAX_BUFFERED_INPUT = http::request_parser::MAX_HEAD_SIZE + http::request_parser::MAX_BODY_SIZE;
+
     int fd;
     sockaddr_in address;
     std::list<connection> connections; // Stores all connections file descriptors for proper shutdown
     std::mutex connections_mutex;
-    int max_connections;
-    bool running = false;
+    int max_connections = 100;
+    std::atomic<bool> running{false};
+
+    io_mode mode;
+    int io_threads;
+    std::vector<std::unique_ptr<event_loop>> loops;
+    std::atomic<int> active_connections{0};
+    std::atomic<uint64_t> next_client_id{0};
+    std::unique_ptr<ThreadPool> workers; // runs the controllers for the reactors when set
+    bool async_controllers = false; // the reactors then serve every batch from a coroutine
+    std::atomic<int> async_pending{0}; // batches whose coroutine hasn't reported to its loop yet
 
     bool use_tls = false;
-    SSL_CTX* ssl_ctx;
+    SSL_CTX* ssl_ctx = nullptr;
 
-    std::map<std::string, std::vector<char>> static_files;
+    StaticFiles static_files;
+    bool compress_responses = false; // on-the-fly compression of the controller responses
+    size_t compress_min_size = 0;
+    int compress_level = 6;
     std::list<std::unique_ptr<Controller>> controllers;
+    Router router;
+    std::unique_ptr<middleware_chain> middlewares;
+    std::unique_ptr<MetricsController> metrics_controller; // kept apart so use_controllers doesn't drop it
+    std::unique_ptr<AdmissionControl> admission; // limits the requests running in the controllers when set
+
+    // Runs the middlewares around the routing and the controller
+    http::response process_request(http::request& req);
+    // Same as process_request, awaiting the async controllers instead of blocking on them
+    async::task<http::response> process_request_async(http::request& req);
+    // Returns the controller of the request, or nullptr when res already holds the 404, 405 or 501 answer
+    Controller* route_request(http::request& req, http::response& res);
+    // Answers from the static files or the controllers, keep_alive is set from the request headers
+    reply build_response(http::request& req, bool& keep_alive);
+    // Fills out with the 503 of a request over the concurrency limit
+    void shed_request(http::request& req, reply& out, bool& keep_alive);
+    // Refuses a connection over max_connections with a 503 and closes it
+    void shed_connection(int client_fd);
+    // Answers the request from the static files, returns false when it isn't one
+    bool static_response(http::request& req, reply& out, bool& keep_alive);
+    // Serializes a controller response
+    reply controller_reply(http::request& req, http::response& res, bool& keep_alive);
+    // Adds the answer to the metrics and to the access log of the client ip
+    void record_request(std::string_view ip, const http::request& req, const reply& out,
+                        std::chrono::steady_clock::time_point start);
+    // Answers pipelined requests in order, stops after the first one that closes the connection
+    // Each answer is recorded in the access log of the client ip
+    std::pmr::vector<reply> build_responses(std::pmr::vector<http::request>& batch, bool& keep_alive, std::string_view ip);
+    // Answers a Range request on a static file with a 206 or a 416
+    // Returns false when the whole file should be sent instead
+    bool range_response(http::request& req, reply& out, bool keep_alive);
+    // Queues the responses on the client and starts the write phase
+    void set_output(client_state& client, std::pmr::vector<reply> output);
 
     void start_server_loop();
     void handle_client(int socket_fd, std::unique_ptr<sockaddr_in> address, std::list<connection>::iterator it);
     void handle_tls_client(SSL* ssl, int socket_fd, std::unique_ptr<sockaddr_in> address, std::list<connection>::iterator it);
+
+    // epoll reactor
+    void start_event_loops();
+    void run_event_loop(event_loop& loop);
+    void accept_clients(event_loop& loop);
+    void handle_event(event_loop& loop, client_state& client, uint32_t events);
+    void drive_client(event_loop& loop, client_state& client);
+    // Takes the complete requests out of the input buffer, returns false when there is none yet
+    // Afterwards the client is either writing the responses or waiting for the workers
+    bool serve_request(event_loop& loop, client_state& client);
+    // Arena for a batch leaving the loop thread, a spare one when the loop has some
+    std::unique_ptr<Arena> take_arena(event_loop& loop);
+    void dispatch_requests(event_loop& loop, client_state& client, std::unique_ptr<Arena> arena,
+                           std::pmr::vector<http::request>& batch);
+    // Answers the batch of done from a coroutine, the responses are reported to the loop once the last one is ready
+    async::detached serve_async(event_loop* loop, std::string ip, completion done);
+    void post_completion(event_loop& loop, completion done);
+    void drain_completions(event_loop& loop);
+    // Reads until the socket is drained or the input holds limit bytes, false when the peer left or the read failed
+    bool read_client(client_state& client, size_t limit = SIZE_MAX);
+    bool write_client(client_state& client);
+    // Drops the pieces sent, a short write leaves the current one partially done
+    static void output_sent(client_state& client, size_t sent);
+    void close_client(event_loop& loop, client_state& client);
+
+    // io_uring backend
+    void run_ring_loop(event_loop& loop);
+    void handle_ring_completion(event_loop& loop, const io_uring_cqe& cqe);
+    void ring_accept(event_loop& loop, int client_fd);
+    void ring_process(event_loop& loop, client_state& client);
+    void ring_send(event_loop& loop, client_state& client);
+    void ring_close(event_loop& loop, client_state& client);
 public:
-    Server(const std::string& host, uint16_t port);
+    // io_threads is the number of reactor threads used by io_mode::epoll and io_mode::sharded, 0 means one per core
+    Server(const std::string& host, uint16_t port, io_mode mode = io_mode::threaded, int io_threads = 0);
     ~Server();
     void listen_for_clients(int max = 100);
-    void use_static_files(const std::string& dir = "wwwroot");
+    // Files bigger than map_threshold bytes are mapped on first use instead of being read at startup
+    void use_static_files(const std::string& dir = "wwwroot", size_t map_threshold = StaticFiles::DEFAULT_MAP_THRESHOLD);
+    // Reloads the static files changed on disk without restarting, the requests in flight keep the old content
+    // as long as the mapped files are replaced with a rename rather than rewritten in place
+    void watch_static_files();
+    // Compresses the controller responses of at least min_size bytes when the client accepts gzip or deflate
+    // level goes from 1 (fastest) to 9 (smallest)
+    void use_compression(size_t min_size = 1024, int level = 6);
+    // Runs the controllers on a pool of count workers (0 means one per core) instead of the epoll reactor threads
+    void use_workers(int count = 0);
+    // Logs the records of at least level, keeping one access and connection record out of sample_every
+    // The lines go to the file at path, or to stdout when it is empty, written by a background thread
+    void use_logging(log_level level = log_level::info, unsigned sample_every = 1, const std::string& path = "");
+    // Sheds the controller requests over an adaptive concurrency limit with a 503 and a Retry-After
+    // The limit starts at initial_limit and backs off whenever a handler takes longer than target
+    void use_admission_control(std::chrono::milliseconds target = std::chrono::milliseconds(100),
+                               int initial_limit = 32, int max_limit = 1024);
+    // Serves the latency histograms and the counters in the Prometheus text format on route
+    void use_metrics(const std::string& route = "metrics");
+
+    // Runs the middlewares Types in order around the controllers, replaces the previous chain
+    template <typename... Types>
+    void use_middlewares() {
+        middlewares = std::make_unique<MiddlewareChain<Types...>>();
+    }
 
     template <typename... Types>
     void use_controllers() {
         controllers.clear();
+        router.clear();
+        async_controllers = false;
         (add_controller<Types>(), ...);
+        if (metrics_controller)
+            add_route(*metrics_controller);
     }
 
     template <typename T>
@@ -55,11 +304,21 @@ public:
                       "Template parameter must be derived from the Controller class");
 
         std::unique_ptr<T> controller = std::make_unique<T>();
+        add_route(*controller);
+        async_controllers = async_controllers || controller->is_async();
         controllers.push_back(std::move(controller));
     }
 
     void use_https(const std::string& cert_file, const std::string& key_file);
     void terminate();
+
+private:
+    // Builds the verb table of the controller and routes its verbs to it
+    template <typename T>
+    void add_route(T& controller) {
+        controller.template bind_handlers<T>();
+        router.add(controller.get_route(), &controller, T::template handled_verbs<T>());
+    }
 };
 
 #endif // SERVER_H
@@ -0,0 +1,134 @@
+#ifndef STATIC_FILES_H
+#define STATIC_FILES_H
+
+#include <sys/types.h>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <unordered_map>
+#include <functional>
+
+// One representation of a static file (identity or gzip) with its serialized response heads
+// A head holds the status line and the headers up to the blank line
+struct static_variant {
+    std::string etag;
+    std::string head_keep_alive; // 200 for a persistent connection
+    std::string head_close;      // 200 announcing Connection: close
+    std::string not_modified_keep_alive; // 304 answering a matching conditional request
+    std::string not_modified_close;
+
+    std::string_view head(bool keep_alive) const {
+        return keep_alive ? head_keep_alive : head_close;
+    }
+    std::string_view not_modified(bool keep_alive) const {
+        return keep_alive ? not_modified_keep_alive : not_modified_close;
+    }
+};
+
+// A static file and its representations
+// Small files are read in memory when loaded, large ones are only stat'd and mapped the first time they are requested
+struct static_asset {
+    std::string content_type;
+    time_t modified = 0;
+    std::string last_modified; // modified in the HTTP date format
+    size_t size = 0;
+    std::vector<char> body; // content of a small file
+    std::string path;       // file mapped on first use, empty for a small file
+    ino_t inode = 0;        // inode of the loaded version, a file replaced since then is not mapped
+    timespec changed{};     // modification time of the loaded version, with nanoseconds
+    static_variant identity;
+
+    // Compressed when loaded, empty for a mapped file, when the type isn't compressible or it didn't get smaller
+    std::vector<char> gzip_body;
+    static_variant gzip;
+
+    static_asset() = default;
+    static_asset(const static_asset&) = delete;
+    static_asset& operator=(const static_asset&) = delete;
+    ~static_asset();
+
+    std::string_view gzip_content() const {
+        return std::string_view(gzip_body.data(), gzip_body.size());
+    }
+
+    // Returns the file bytes, a large file is opened, mapped and closed again on first use
+    // Throws when it can't be mapped or isn't the loaded version anymore, the next call tries again
+    std::string_view content() const;
+    bool is_mapped() const {
+        return mapped.load(std::memory_order_acquire) != nullptr;
+    }
+private:
+    mutable std::once_flag map_once;
+    mutable std::atomic<const char*> mapped{nullptr};
+};
+
+// Cache of the static files served by the server, read once when loaded
+// Assets are shared so a response can keep borrowing the bytes while it is being sent
+// The map is an immutable snapshot, a reload builds a new one and publishes it whole (RCU style)
+// Every reload makes new assets with their own mapping, the old ones live until their last reply
+// No descriptor stays open, the open files don't grow with the directory
+class StaticFiles {
+private:
+    // Transparent so a lookup by string_view doesn't build a std::string
+    struct uri_hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view uri) const {
+            return std::hash<std::string_view>{}(uri);
+        }
+    };
+    using asset_map = std::unordered_map<std::string, std::shared_ptr<const static_asset>, uri_hash, std::equal_to<>>; // by uri
+
+    // Each lookup holds the snapshot it read only until it returns, a superseded one is freed with its last reply
+    std::atomic<std::shared_ptr<const asset_map>> assets{std::make_shared<asset_map>()};
+
+    std::string root;
+    size_t map_threshold = DEFAULT_MAP_THRESHOLD;
+
+    // inotify watcher
+    int inotify_fd = -1;
+    int stop_fd = -1; // eventfd waking the watcher up to exit
+    std::thread watcher;
+    std::unordered_map<int, std::string> watched_dirs; // watch descriptor to directory path
+
+    std::shared_ptr<const asset_map> snapshot() const {
+        return assets.load(std::memory_order_acquire);
+    }
+    void publish(std::shared_ptr<const asset_map> next);
+    void watch_dir(const std::string& dir);
+    void unwatch_dir(const std::string& dir);
+    void run_watcher();
+    // Reloads the changed paths into a copy of the current snapshot, then publishes it
+    void apply_changes(const std::vector<std::string>& changed);
+public:
+    static constexpr size_t DEFAULT_MAP_THRESHOLD = 262144;
+
+    StaticFiles() = default;
+    ~StaticFiles();
+
+    StaticFiles(const StaticFiles&) = delete;
+    StaticFiles& operator=(const StaticFiles&) = delete;
+
+    // Indexes every file under dir, replacing the current content
+    // Files bigger than map_threshold bytes are not read, they are mapped when first requested
+    // A file that can't be read is logged and left out
+    // Text based files read in memory are also compressed with gzip
+    void load(const std::string& dir, size_t map_threshold = DEFAULT_MAP_THRESHOLD);
+
+    // Watches the loaded directory with inotify and reloads the files that change, are added or removed
+    void watch();
+
+    // Returns the asset served at uri, "/" falls back to "/index.html", nullptr when there is none
+    std::shared_ptr<const static_asset> find(std::string_view uri) const;
+
+    bool empty() const {
+        return snapshot()->empty();
+    }
+};
+
+#endif // STATIC_FILES_H
@@ -0,0 +1,171 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+
+namespace async {
+
+template<typename T>
+class task;
+
+// Result side of the promise, T is stored once the coroutine returns
+template<typename T>
+struct task_result {
+    std::optional<T> value; // T doesn't have to be default constructible
+    std::exception_ptr error;
+
+    void return_value(T result) {
+        value.emplace(std::move(result));
+    }
+    T result() {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template<>
+struct task_result<void> {
+    std::exception_ptr error;
+
+    void return_void() {}
+    void result() {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+template<typename T>
+struct task_promise : task_result<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    // Hands the thread straight to the awaiting coroutine, so deep chains don't grow the stack
+    struct final_awaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<task_promise> handle) noexcept {
+            return handle.promise().continuation;
+        }
+        void await_resume() noexcept {}
+    };
+
+    task<T> get_return_object() noexcept;
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+    final_awaiter final_suspend() noexcept {
+        return {};
+    }
+    void unhandled_exception() noexcept {
+        this->error = std::current_exception();
+    }
+};
+
+// Coroutine producing a T, it starts when awaited and resumes the awaiting coroutine when done
+// Wherever the coroutine is resumed (a timer, a socket, a worker) the awaiting one continues on that thread
+template<typename T = void>
+class [[nodiscard]] task {
+public:
+    using promise_type = task_promise<T>;
+private:
+    std::coroutine_handle<promise_type> handle;
+public:
+    explicit task(std::coroutine_handle<promise_type> handle): handle(handle) {}
+    task(task&& other) noexcept: handle(std::exchange(other.handle, nullptr)) {}
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() const noexcept {
+        return !handle || handle.done();
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume() {
+        return handle.promise().result();
+    }
+};
+
+template<typename T>
+task<T> task_promise<T>::get_return_object() noexcept {
+    return task<T>(std::coroutine_handle<task_promise>::from_promise(*this));
+}
+
+// Fire and forget coroutine, runs eagerly and frees itself at the end
+// Its body must handle its own exceptions
+struct detached {
+    struct promise_type {
+        detached get_return_object() noexcept {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+template<typename T>
+struct sync_state {
+    std::mutex mutex;
+    std::condition_variable finished_cv;
+    bool finished = false;
+    task_result<T> outcome;
+};
+
+template<typename T>
+detached run_sync(task<T> work, sync_state<T>* state) {
+    try {
+        if constexpr (std::is_void<T>::value) {
+            co_await work;
+            state->outcome.return_void();
+        } else {
+            state->outcome.return_value(co_await work);
+        }
+    } catch (...) {
+        state->outcome.error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->finished = true;
+    state->finished_cv.notify_one();
+}
+
+// Blocks the calling thread until the task is done, for the callers that can't be coroutines
+template<typename T>
+T sync_wait(task<T> work) {
+    sync_state<T> state;
+    run_sync(std::move(work), &state);
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.finished_cv.wait(lock, [&state]() { return state.finished; });
+    return state.outcome.result();
+}
+
+}
+
+#endif // TASK_H
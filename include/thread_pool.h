@@ -0,0 +1,55 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <functional>
+
+// Fixed size pool of worker threads
+// Every worker owns a deque: it pops its own tasks from the back and steals from the front of the others when idle
+class ThreadPool {
+private:
+    struct worker {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<worker>> workers;
+    std::atomic<bool> running{true};
+    std::atomic<unsigned> next{0}; // round robin target for tasks submitted from outside the pool
+    std::atomic<int> queued{0}; // tasks waiting in a deque
+    std::atomic<int> pending{0}; // queued and running tasks
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+
+    void run(int index);
+    bool pop(int index, std::function<void()>& task);
+    bool steal(int index, std::function<void()>& task);
+public:
+    // count 0 means one worker per core
+    ThreadPool(int count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Queues the task, tasks submitted by a worker stay on that worker's deque
+    void submit(std::function<void()> task);
+
+    // Blocks until every queued task has finished
+    void wait_idle();
+
+    int size() const {
+        return (int)workers.size();
+    }
+};
+
+#endif // THREAD_POOL_H
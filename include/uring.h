@@ -0,0 +1,79 @@
+#ifndef URING_H
+#define URING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper over the raw system calls
+// Only the owning thread may touch a ring
+class IoUring {
+private:
+    int fd = -1;
+
+    // Submission queue
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    io_uring_sqe* sqes;
+    unsigned sqe_tail = 0; // local tail, published to sq_tail on submit
+    size_t sq_ring_size;
+    void* sq_ring = nullptr;
+    size_t sqes_size;
+
+    // Completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+    size_t cq_ring_size;
+    void* cq_ring = nullptr;
+
+    // Provided buffers ring
+    io_uring_buf_ring* buf_ring = nullptr;
+    size_t buf_ring_size = 0;
+    char* buffers = nullptr;
+    unsigned buffer_count = 0;
+    unsigned buffer_size = 0;
+public:
+    IoUring(unsigned entries);
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // Returns a zeroed submission entry, flushes the queue to the kernel when it is full
+    io_uring_sqe* get_sqe();
+
+    // Submits the queued entries and waits for at least wait_nr completions
+    int submit(unsigned wait_nr = 0);
+
+    // Calls f(const io_uring_cqe&) for every available completion and marks them as seen
+    template<typename F>
+    unsigned for_each_cqe(F f) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        while (head != tail) {
+            f(cqes[head & cq_mask]);
+            head++;
+            count++;
+            // Released one by one since f can submit and the kernel needs the room
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            if (head == tail)
+                tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        }
+        return count;
+    }
+
+    // Registers count buffers of size bytes the kernel picks from for IOSQE_BUFFER_SELECT reads
+    void setup_buffers(uint16_t group, unsigned count, unsigned size);
+    char* buffer(uint16_t id) const {
+        return buffers + (size_t)id * buffer_size;
+    }
+    // Hands a consumed buffer back to the kernel
+    void recycle_buffer(uint16_t id);
+};
+
+#endif // URING_H
@@ -0,0 +1,52 @@
+#include "admission.h"
+#include "metrics.h"
+
+#include <algorithm>
+
+AdmissionControl::AdmissionControl(std::chrono::steady_clock::duration target, int initial_limit, int max_limit):
+    target(target), max_limit(std::max(max_limit, MIN_LIMIT)),
+    limit((double)std::clamp(initial_limit, MIN_LIMIT, std::max(max_limit, MIN_LIMIT))) {
+    Metrics::instance().concurrency_limit(current_limit());
+}
+
+bool AdmissionControl::try_acquire() {
+    int running = in_flight.fetch_add(1, std::memory_order_relaxed);
+    if (running >= (int)limit.load(std::memory_order_relaxed)) {
+        in_flight.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void AdmissionControl::publish(double value) {
+    // Called when the whole part of the limit changes, the gauge is an integer
+    Metrics::instance().concurrency_limit((int)value);
+}
+
+void AdmissionControl::release(std::chrono::steady_clock::duration latency) {
+    int running = in_flight.fetch_sub(1, std::memory_order_relaxed);
+    double current = limit.load(std::memory_order_relaxed);
+
+    if (latency > target) {
+        // A burst of slow requests is one congestion signal, not one per request
+        int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+        int64_t last = last_decrease.load(std::memory_order_relaxed);
+        if (now - last < target.count() || !last_decrease.compare_exchange_strong(last, now))
+            return;
+        double next = std::max(current * BACKOFF, (double)MIN_LIMIT);
+        limit.store(next, std::memory_order_relaxed);
+        if ((int)next != (int)current)
+            publish(next);
+        return;
+    }
+
+    // An idle server would otherwise raise the limit forever without ever testing it
+    if (running < current / 2 || current >= max_limit)
+        return;
+    double next;
+    do {
+        next = std::min(current + 1.0 / current, (double)max_limit);
+    } while (!limit.compare_exchange_weak(current, next, std::memory_order_relaxed));
+    if ((int)next != (int)current)
+        publish(next);
+}
@@ -0,0 +1,34 @@
+#include "arena.h"
+
+#include <memory_resource>
+
+// Arena of the innermost open scope of the thread
+static thread_local Arena* active = nullptr;
+
+Arena::Arena(): resource(initial, sizeof(initial), std::pmr::new_delete_resource()) {}
+
+Arena& Arena::local() {
+    static thread_local Arena arena;
+    return arena;
+}
+
+Arena::scope::scope(): arena(local()), previous(active), thread_arena(true) {
+    arena.depth++;
+    active = &arena;
+}
+
+Arena::scope::scope(Arena& arena): arena(arena), previous(active), thread_arena(false) {
+    active = &arena;
+}
+
+Arena::scope::~scope() {
+    active = previous;
+    if (thread_arena && --arena.depth == 0)
+        arena.reset();
+}
+
+std::pmr::memory_resource* Arena::current() {
+    if (active == nullptr)
+        return std::pmr::get_default_resource();
+    return &active->resource;
+}
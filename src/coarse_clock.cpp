@@ -0,0 +1,58 @@
+#include "coarse_clock.h"
+#include "helpers.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+CoarseClock::CoarseClock() {
+    // The first stamp is ready before anyone can read it
+    tick(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
+    thread = std::thread(&CoarseClock::run, this);
+}
+
+CoarseClock::~CoarseClock() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    stop_cv.notify_one();
+    thread.join();
+}
+
+CoarseClock& CoarseClock::instance() {
+    static CoarseClock clock;
+    return clock;
+}
+
+void CoarseClock::tick(time_t seconds) {
+    stamp& s = stamps[next];
+    next = (next + 1) % SLOTS;
+
+    s.seconds = seconds;
+    std::string date = http_date(seconds);
+    std::memcpy(s.date, date.data(), DATE_SIZE);
+    s.date[DATE_SIZE] = '\0';
+
+    tm parts;
+    localtime_r(&seconds, &parts);
+    std::snprintf(s.log, sizeof(s.log), "%02d:%02d:%02d", parts.tm_hour, parts.tm_min, parts.tm_sec);
+
+    current.store(&s, std::memory_order_release);
+}
+
+void CoarseClock::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        // Wakes on the next second boundary, so the strings change when the wall clock does
+        auto now = std::chrono::system_clock::now();
+        auto boundary = std::chrono::floor<std::chrono::seconds>(now) + std::chrono::seconds(1);
+        if (stop_cv.wait_until(lock, boundary, [this]() { return !running; }))
+            break;
+
+        // Not time(), it may read a coarser clock still showing the previous second
+        time_t seconds = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        if (seconds != current.load(std::memory_order_relaxed)->seconds)
+            tick(seconds);
+    }
+}
@@ -0,0 +1,137 @@
+#include "compression.h"
+#include "header_map.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+#include <zlib.h>
+
+namespace http {
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static std::string_view trim(std::string_view s) {
+    while (!s.empty() && is_space(s.front()))
+        s.remove_prefix(1);
+    while (!s.empty() && is_space(s.back()))
+        s.remove_suffix(1);
+    return s;
+}
+
+content_coding negotiate_encoding(std::string_view accept_encoding, unsigned available) {
+    // -1 means not listed, otherwise the weight in thousandths
+    int gzip = -1;
+    int deflate = -1;
+    int any = -1;
+
+    while (!accept_encoding.empty()) {
+        size_t comma = accept_encoding.find(',');
+        std::string_view item = accept_encoding.substr(0, comma);
+        accept_encoding = comma == std::string_view::npos ? std::string_view() : accept_encoding.substr(comma + 1);
+
+        size_t semicolon = item.find(';');
+        std::string_view coding = trim(item.substr(0, semicolon));
+        int weight = 1000;
+        if (semicolon != std::string_view::npos) {
+            std::string_view param = trim(item.substr(semicolon + 1));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+                weight = (int)(std::atof(std::string(param.substr(2)).c_str()) * 1000);
+        }
+
+        if (iequals(coding, "gzip") || iequals(coding, "x-gzip"))
+            gzip = weight;
+        else if (iequals(coding, "deflate"))
+            deflate = weight;
+        else if (coding == "*")
+            any = weight;
+    }
+
+    if (gzip < 0)
+        gzip = any;
+    if (deflate < 0)
+        deflate = any;
+    // A coding the response doesn't have leaves the choice to the others
+    if (!(available & coding_bit(content_coding::gzip)))
+        gzip = 0;
+    if (!(available & coding_bit(content_coding::deflate)))
+        deflate = 0;
+    if (gzip > 0 && gzip >= deflate)
+        return content_coding::gzip;
+    if (deflate > 0)
+        return content_coding::deflate;
+    return content_coding::identity;
+}
+
+const char* coding_name(content_coding coding) {
+    switch (coding) {
+    case content_coding::gzip:
+        return "gzip";
+    case content_coding::deflate:
+        return "deflate";
+    default:
+        return "identity";
+    }
+}
+
+bool compressible(std::string_view content_type) {
+    // Parameters such as "; charset=utf-8" don't matter
+    content_type = trim(content_type.substr(0, content_type.find(';')));
+    if (content_type.substr(0, 5) == "text/")
+        return true;
+    return content_type == "application/javascript" ||
+           content_type == "application/json" ||
+           content_type == "application/xml" ||
+           content_type == "image/svg+xml";
+}
+
+// zlib counts the bytes in uInt, the input and the output go through it in chunks
+static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+std::string compress(std::string_view data, content_coding coding, int level) {
+    if (coding == content_coding::identity)
+        return std::string(data);
+
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    // 15 bits window, +16 asks zlib for the gzip wrapper instead of the zlib one
+    int window_bits = coding == content_coding::gzip ? 15 + 16 : 15;
+    if (deflateInit2(&stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("Failed to initialize zlib");
+
+    // The first output chunk takes a whole small body, bigger ones grow a chunk at a time
+    std::string output;
+    size_t offset = 0;
+    size_t out_chunk = std::min<size_t>(deflateBound(&stream, std::min(data.size(), CHUNK_SIZE)), CHUNK_SIZE);
+    int result = Z_OK;
+    while (result != Z_STREAM_END) {
+        if (stream.avail_in == 0 && offset < data.size()) {
+            size_t length = std::min(data.size() - offset, CHUNK_SIZE);
+            stream.next_in = (Bytef*)data.data() + offset;
+            stream.avail_in = (uInt)length;
+            offset += length;
+        }
+        size_t used = output.size();
+        output.resize(used + out_chunk);
+        stream.next_out = (Bytef*)output.data() + used;
+        stream.avail_out = (uInt)out_chunk;
+
+        result = deflate(&stream, offset == data.size() ? Z_FINISH : Z_NO_FLUSH);
+        output.resize(output.size() - stream.avail_out);
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+            deflateEnd(&stream);
+            throw std::runtime_error("Failed to compress the response");
+        }
+        out_chunk = CHUNK_SIZE;
+    }
+    deflateEnd(&stream);
+    return output;
+}
+
+}
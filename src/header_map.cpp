@@ -0,0 +1,267 @@
+#include "header_map.h"
+
+#include <new>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <utility>
+
+namespace http {
+
+static constexpr std::string_view field_names[FIELD_COUNT] = {
+    "Accept-Encoding",
+    "Allow",
+    "Connection",
+    "Content-Encoding",
+    "Content-Length",
+    "Content-Range",
+    "Content-Type",
+    "Date",
+    "ETag",
+    "Host",
+    "If-Modified-Since",
+    "If-None-Match",
+    "If-Range",
+    "Last-Modified",
+    "Location",
+    "Range",
+    "Retry-After",
+    "Server",
+    "Transfer-Encoding",
+    "Vary",
+};
+
+struct field_hash_table {
+    uint32_t values[FIELD_COUNT];
+
+    constexpr field_hash_table(): values() {
+        for (int i = 0; i < FIELD_COUNT; i++)
+            values[i] = header_hash(field_names[i]);
+    }
+};
+
+static constexpr field_hash_table field_hashes;
+
+std::string_view field_name(field f) {
+    return field_names[(int)f];
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        char x = a[i];
+        char y = b[i];
+        if (x == y)
+            continue;
+        // Only letters may differ, and only by the case bit
+        if ((x ^ y) != 0x20)
+            return false;
+        char lower = (char)(x | 0x20);
+        if (lower < 'a' || lower > 'z')
+            return false;
+    }
+    return true;
+}
+
+header_map::header_map(): header_map(allocator_type()) {}
+
+header_map::header_map(const allocator_type& alloc): resource(alloc.resource()), entries(inline_entries()) {}
+
+header_map::header_map(const header_map& other): header_map(other, allocator_type()) {}
+
+header_map::header_map(const header_map& other, const allocator_type& alloc): header_map(alloc) {
+    reserve(other.used);
+    for (size_t i = 0; i < other.used; i++) {
+        construct(&entries[i], other.entries[i]);
+        used++;
+    }
+}
+
+header_map::header_map(header_map&& other) noexcept: header_map(other.get_allocator()) {
+    take(other);
+}
+
+header_map::header_map(header_map&& other, const allocator_type& alloc): header_map(alloc) {
+    take(other);
+}
+
+header_map& header_map::operator=(const header_map& other) {
+    if (this != &other) {
+        header_map copy(other, get_allocator());
+        release();
+        take(copy);
+    }
+    return *this;
+}
+
+header_map& header_map::operator=(header_map&& other) {
+    if (this != &other) {
+        release();
+        take(other);
+    }
+    return *this;
+}
+
+void header_map::take(header_map& other) {
+    if (!other.is_inline() && *other.resource == *resource) {
+        // An overflow array of the same resource changes owner as is
+        entries = other.entries;
+        used = other.used;
+        capacity = other.capacity;
+        other.entries = other.inline_entries();
+        other.used = 0;
+        other.capacity = INLINE_HEADERS;
+        return;
+    }
+    reserve(other.used);
+    for (size_t i = 0; i < other.used; i++) {
+        construct(&entries[i], std::move(other.entries[i]));
+        used++;
+    }
+    other.clear();
+}
+
+header_map::~header_map() {
+    release();
+}
+
+void header_map::release() {
+    clear();
+    if (!is_inline()) {
+        resource->deallocate(entries, capacity * sizeof(entry), alignof(entry));
+        entries = inline_entries();
+        capacity = INLINE_HEADERS;
+    }
+}
+
+// The strings of an entry always come from the resource of the map holding it
+void header_map::construct(entry* at, const entry& from) {
+    new (at) entry{{std::pmr::string(from.header.first, resource), std::pmr::string(from.header.second, resource)},
+                   from.hash};
+}
+
+void header_map::construct(entry* at, entry&& from) {
+    new (at) entry{{std::pmr::string(std::move(from.header.first), resource),
+                    std::pmr::string(std::move(from.header.second), resource)},
+                   from.hash};
+}
+
+void header_map::reserve(size_t wanted) {
+    if (wanted <= capacity)
+        return;
+    size_t next = capacity * 2;
+    while (next < wanted)
+        next *= 2;
+
+    entry* grown = static_cast<entry*>(resource->allocate(next * sizeof(entry), alignof(entry)));
+    for (size_t i = 0; i < used; i++) {
+        construct(&grown[i], std::move(entries[i]));
+        entries[i].~entry();
+    }
+    if (!is_inline())
+        resource->deallocate(entries, capacity * sizeof(entry), alignof(entry));
+    entries = grown;
+    capacity = next;
+}
+
+header_map::entry* header_map::lookup(std::string_view name, uint32_t hash) const {
+    for (size_t i = 0; i < used; i++) {
+        if (entries[i].hash == hash && iequals(entries[i].header.first, name))
+            return &entries[i];
+    }
+    return nullptr;
+}
+
+header_map::entry& header_map::append(std::string_view name, uint32_t hash) {
+    reserve(used + 1);
+    entry* added = new (&entries[used]) entry{{std::pmr::string(name, resource), std::pmr::string(resource)}, hash};
+    used++;
+    return *added;
+}
+
+header_map::iterator header_map::find(std::string_view name) {
+    entry* found = lookup(name, header_hash(name));
+    return found != nullptr ? iterator(found) : end();
+}
+
+header_map::const_iterator header_map::find(std::string_view name) const {
+    const entry* found = lookup(name, header_hash(name));
+    return found != nullptr ? const_iterator(found) : end();
+}
+
+header_map::iterator header_map::find(field name) {
+    entry* found = lookup(field_name(name), field_hashes.values[(int)name]);
+    return found != nullptr ? iterator(found) : end();
+}
+
+header_map::const_iterator header_map::find(field name) const {
+    const entry* found = lookup(field_name(name), field_hashes.values[(int)name]);
+    return found != nullptr ? const_iterator(found) : end();
+}
+
+std::pmr::string& header_map::operator[](std::string_view name) {
+    uint32_t hash = header_hash(name);
+    entry* found = lookup(name, hash);
+    if (found != nullptr)
+        return found->header.second;
+    return append(name, hash).header.second;
+}
+
+std::pmr::string& header_map::operator[](field name) {
+    uint32_t hash = field_hashes.values[(int)name];
+    entry* found = lookup(field_name(name), hash);
+    if (found != nullptr)
+        return found->header.second;
+    return append(field_name(name), hash).header.second;
+}
+
+std::pmr::string& header_map::at(std::string_view name) {
+    entry* found = lookup(name, header_hash(name));
+    if (found == nullptr)
+        throw std::out_of_range("Missing header");
+    return found->header.second;
+}
+
+const std::pmr::string& header_map::at(std::string_view name) const {
+    const entry* found = lookup(name, header_hash(name));
+    if (found == nullptr)
+        throw std::out_of_range("Missing header");
+    return found->header.second;
+}
+
+std::pair<header_map::iterator, bool> header_map::emplace(std::string_view name, std::string_view value) {
+    uint32_t hash = header_hash(name);
+    entry* found = lookup(name, hash);
+    if (found != nullptr)
+        return {iterator(found), false};
+    entry& added = append(name, hash);
+    added.header.second = value;
+    return {iterator(&added), true};
+}
+
+size_t header_map::erase(std::string_view name) {
+    entry* found = lookup(name, header_hash(name));
+    if (found == nullptr)
+        return 0;
+    erase(const_iterator(found));
+    return 1;
+}
+
+header_map::iterator header_map::erase(const_iterator position) {
+    // Shifts the following entries down to keep the insertion order
+    size_t index = position.current - entries;
+    for (size_t i = index; i + 1 < used; i++)
+        entries[i] = std::move(entries[i + 1]);
+    entries[used - 1].~entry();
+    used--;
+    return iterator(entries + index);
+}
+
+void header_map::clear() {
+    for (size_t i = 0; i < used; i++)
+        entries[i].~entry();
+    used = 0;
+}
+
+}
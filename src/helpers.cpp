@@ -1,9 +1,13 @@
 #include "helpers.h"
+#include "coarse_clock.h"
 
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <climits>
+#include <cerrno>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <cstring>
@@ -48,6 +52,89 @@ std::map<std::string, std::vector<char>> get_all_files(const std::string& dir) {
     return files;
 }
 
+static void wait_readable(int fd, int timeout) {
+    fd_set readfds;
+    struct timeval tv;
+    FD_ZERO(&readfds);
+    FD_SET(fd, &readfds);
+    tv.tv_sec = timeout;
+    tv.tv_usec = 0;
+
+    int result = select(fd + 1, &readfds, nullptr, nullptr, &tv);
+
+    if (result == -1) {
+        throw std::runtime_error("Failed to select socket fd");
+    } else if (result == 0) {
+        throw std::runtime_error("Timeout occured");
+    }
+}
+
+int read_some(int fd, std::string& buffer, int timeout) {
+    wait_readable(fd, timeout);
+
+    char data[BUFFER_SIZE];
+    int bytes_read = read(fd, data, BUFFER_SIZE);
+    if (bytes_read < 0)
+        throw std::runtime_error("Failed to read from file descriptor");
+    buffer.append(data, bytes_read);
+    return bytes_read;
+}
+
+int read_some(SSL* ssl, int fd, std::string& buffer, int timeout) {
+    // Decrypted bytes may already be waiting in the SSL buffer while the socket is empty
+    if (SSL_pending(ssl) == 0)
+        wait_readable(fd, timeout);
+
+    char data[BUFFER_SIZE];
+    int bytes_read = SSL_read(ssl, data, BUFFER_SIZE);
+    if (bytes_read <= 0) {
+        if (SSL_get_error(ssl, bytes_read) == SSL_ERROR_ZERO_RETURN)
+            return 0;
+        throw std::runtime_error("Failed to read from file descriptor");
+    }
+    buffer.append(data, bytes_read);
+    return bytes_read;
+}
+
+void write_all(int fd, std::pmr::vector<iovec>& iov) {
+    size_t index = 0;
+    while (index < iov.size()) {
+        int count = (int)std::min(iov.size() - index, (size_t)IOV_MAX);
+        ssize_t written = writev(fd, &iov[index], count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("Failed to write to file descriptor");
+        }
+
+        // Skips what was sent, a short write leaves the current buffer partially done
+        while (written > 0 && index < iov.size()) {
+            if ((size_t)written >= iov[index].iov_len) {
+                written -= iov[index].iov_len;
+                index++;
+            } else {
+                iov[index].iov_base = (char*)iov[index].iov_base + written;
+                iov[index].iov_len -= written;
+                written = 0;
+            }
+        }
+    }
+}
+
+void write_all(SSL* ssl, std::pmr::vector<iovec>& iov) {
+    // SSL has no gather write, the pieces are encrypted one after the other
+    for (iovec& piece: iov) {
+        size_t offset = 0;
+        while (offset < piece.iov_len) {
+            int written = SSL_write(ssl, (char*)piece.iov_base + offset,
+                                    (int)std::min(piece.iov_len - offset, (size_t)INT_MAX));
+            if (written <= 0)
+                throw std::runtime_error("Failed to write to file descriptor");
+            offset += written;
+        }
+    }
+}
+
 std::string read_to_end(int fd, int timeout) {
     fd_set readfds;
     struct timeval tv;
@@ -114,7 +201,7 @@ std::string read_to_end(SSL* ssl, int fd, int timeout) {
         int bytes_read;
 
         do {
-            bytes_read = SSL_read(ssl, data.data(), BUFFER_SIZE);
+            bytes_read = SSL_read(ssl, buffer.data(), BUFFER_SIZE);
             if (bytes_read < 0)
                 throw std::runtime_error("Failed to read from file descriptor");
             data.append((char*)buffer.data(), bytes_read);
@@ -190,23 +277,50 @@ std::string get_content_type(const std::string& filename) {
     return "application/octet-stream";
 }
 
-std::string get_time() {
-    time_t now = time(nullptr);
-    char buffer[26];
-    ctime_r(&now, buffer);
-    std::string str(buffer);
-    int i = 0;
-    int pos = 0;
-    while (true) {
-        if ((pos = (int)str.find(' ', pos)) != std::string::npos) {i++;pos++;}
-        else return "";
-        if (i == 4) {
-            str = str.substr(pos, 8);
-            break;
-        }
+// Names are spelled out since strftime follows the process locale
+static const char* const DAY_NAMES[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char* const MONTH_NAMES[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                          "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+std::string http_date(time_t time) {
+    tm parts;
+    gmtime_r(&time, &parts);
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+             DAY_NAMES[parts.tm_wday], parts.tm_mday, MONTH_NAMES[parts.tm_mon], parts.tm_year + 1900,
+             parts.tm_hour, parts.tm_min, parts.tm_sec);
+    return buffer;
+}
+
+bool parse_http_date(std::string_view date, time_t& time) {
+    // "Sun, 06 Nov 1994 08:49:37 GMT", copied to be terminated for sscanf
+    char text[32];
+    if (date.size() >= sizeof(text))
+        return false;
+    std::memcpy(text, date.data(), date.size());
+    text[date.size()] = '\0';
+
+    char day[4], month[4];
+    tm parts{};
+    int consumed = 0;
+    if (sscanf(text, "%3s, %2d %3s %4d %2d:%2d:%2d GMT%n", day, &parts.tm_mday, month, &parts.tm_year,
+               &parts.tm_hour, &parts.tm_min, &parts.tm_sec, &consumed) != 7 || consumed != (int)date.size())
+        return false;
+
+    parts.tm_mon = -1;
+    for (int i = 0; i < 12; i++) {
+        if (strcmp(month, MONTH_NAMES[i]) == 0)
+            parts.tm_mon = i;
     }
+    if (parts.tm_mon < 0)
+        return false;
+    parts.tm_year -= 1900;
+    time = timegm(&parts);
+    return true;
+}
 
-    return str;
+std::string_view get_time() {
+    return CoarseClock::instance().log_time();
 }
 
 std::string ip_to_str(int ip) {
@@ -1,120 +1,542 @@
 #include "http.hpp"
+#include "http_scan.h"
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <array>
+#include <iterator>
 #include <nlohmann/json.hpp>
 
 namespace http {
 
-URI::URI() {}
+URI::URI(const allocator_type& alloc): route(alloc), parameters(alloc) {}
 
-URI::URI(const std::string& uriString) {
-    std::string pathPart, queryPart;
+URI::URI(std::string_view uri, const allocator_type& alloc): URI(alloc) {
+    size_t query_position = uri.find('?');
+    std::string_view path = uri.substr(0, query_position);
+    std::string_view query = query_position != std::string_view::npos ? uri.substr(query_position + 1)
+                                                                      : std::string_view();
 
-    size_t queryPos = uriString.find('?');
-    if (queryPos != std::string::npos) {
-        pathPart = uriString.substr(0, queryPos);
-        queryPart = uriString.substr(queryPos + 1);
-    } else {
-        pathPart = uriString;
+    // Empty segments are skipped, so leading, trailing and doubled slashes don't count
+    while (!path.empty()) {
+        size_t end = std::min(path.find('/'), path.size());
+        if (end > 0)
+            route.emplace_back(path.substr(0, end));
+        path.remove_prefix(std::min(end + 1, path.size()));
     }
 
-    if (!pathPart.empty() && pathPart != "/") {
-        if (pathPart.front() == '/') {
-            pathPart = pathPart.substr(1);
-        }
+    // Empty parameters are skipped like the empty segments, one without a value is stored empty
+    // and the last one of a repeated name wins
+    while (!query.empty()) {
+        size_t end = std::min(query.find('&'), query.size());
+        std::string_view param = query.substr(0, end);
+        query.remove_prefix(std::min(end + 1, query.size()));
+        if (param.empty())
+            continue;
+        size_t equal = param.find('=');
+        std::string_view key = param.substr(0, equal);
+        std::string_view value = equal != std::string_view::npos ? param.substr(equal + 1) : std::string_view();
+        parameters[std::pmr::string(key, alloc)] = value;
+    }
+}
 
-        if (!pathPart.empty() && pathPart.back() == '/') {
-            pathPart.pop_back();
-        }
+URI::URI(const URI& other, const allocator_type& alloc): route(other.route, alloc), parameters(other.parameters, alloc) {}
 
-        std::istringstream pathStream(pathPart);
-        std::string segment;
-        while (getline(pathStream, segment, '/')) {
-            if (!segment.empty()) {
-                route.push_back(segment);
-            }
+URI::URI(URI&& other, const allocator_type& alloc)
+    : route(std::move(other.route), alloc), parameters(std::move(other.parameters), alloc) {}
+
+request::request(const allocator_type& alloc)
+    : method(alloc), uri(alloc), version("HTTP/1.1", alloc), headers(alloc), body(alloc), path_params(alloc) {}
+
+request::request(const request& other, const allocator_type& alloc)
+    : method(other.method, alloc), verb(other.verb), uri(other.uri, alloc), version(other.version, alloc),
+      headers(other.headers, alloc), body(other.body, alloc), path_params(other.path_params, alloc),
+      route(other.route) {}
+
+request::request(request&& other, const allocator_type& alloc)
+    : method(std::move(other.method), alloc), verb(other.verb), uri(std::move(other.uri), alloc),
+      version(std::move(other.version), alloc), headers(std::move(other.headers), alloc),
+      body(std::move(other.body), alloc), path_params(std::move(other.path_params), alloc), route(other.route) {}
+
+response::response(const allocator_type& alloc): version("HTTP/1.1", alloc), status_message(alloc), headers(alloc) {}
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static inline char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+std::string_view request_view::header(std::string_view name) const {
+    for (const header_view& h: headers) {
+        if (iequals(h.name, name))
+            return h.value;
+    }
+    return {};
+}
+
+verb parse_verb(std::string_view method) {
+    // Methods are case sensitive, the length and the first byte are enough to pick the candidate
+    switch (method.size()) {
+    case 3:
+        if (method == "GET")
+            return verb::get;
+        if (method == "PUT")
+            return verb::put;
+        break;
+    case 4:
+        if (method == "HEAD")
+            return verb::head;
+        if (method == "POST")
+            return verb::post;
+        break;
+    case 5:
+        if (method == "PATCH")
+            return verb::patch;
+        if (method == "TRACE")
+            return verb::trace;
+        break;
+    case 6:
+        if (method == "DELETE")
+            return verb::delete_;
+        break;
+    case 7:
+        if (method == "OPTIONS")
+            return verb::options;
+        if (method == "CONNECT")
+            return verb::connect;
+        break;
+    }
+    return verb::unknown;
+}
+
+std::string_view verb_name(verb v) {
+    static constexpr std::string_view names[VERB_COUNT] = {
+        "", "GET", "HEAD", "POST", "PUT", "PATCH", "DELETE", "OPTIONS", "CONNECT", "TRACE",
+    };
+    return names[(int)v];
+}
+
+request request_view::to_request(const request::allocator_type& alloc) const {
+    request req(alloc);
+    req.method = method;
+    req.verb = verb;
+    req.uri = URI(target, alloc);
+    req.version = version;
+    for (const header_view& h: headers)
+        req.headers[h.name] = h.value;
+    req.body = body;
+    return req;
+}
+
+void request_parser::reset() {
+    current = stage::request_line;
+    start = 0;
+    position = 0;
+    headers.clear();
+    body_start = 0;
+    content_length = 0;
+    has_content_length = false;
+    chunked = false;
+    chunk_remaining = 0;
+    decoded_body.clear();
+    view = request_view();
+}
+
+// Validates the headers that frame the body
+parse_status request_parser::parse_header(std::string_view name, std::string_view value) {
+    if (iequals(name, "Content-Length")) {
+        if (value.empty())
+            return parse_status::error;
+        size_t length = 0;
+        for (char c: value) {
+            if (c < '0' || c > '9' || length > (SIZE_MAX - 9) / 10)
+                return parse_status::error;
+            length = length * 10 + (c - '0');
         }
+        // Conflicting lengths are the classic request smuggling vector
+        if (has_content_length && length != content_length)
+            return parse_status::error;
+        has_content_length = true;
+        content_length = length;
+    } else if (iequals(name, "Transfer-Encoding")) {
+        // chunked must be the last coding, anything else can't be framed
+        size_t last = value.find_last_of(',');
+        std::string_view coding = last == std::string_view::npos ? value : value.substr(last + 1);
+        while (!coding.empty() && is_space(coding.front()))
+            coding.remove_prefix(1);
+        if (!iequals(coding, "chunked"))
+            return parse_status::error;
+        chunked = true;
     }
+    return parse_status::complete;
+}
 
-    if (!queryPart.empty()) {
-        std::istringstream queryStream(queryPart);
-        std::string param;
-        while (getline(queryStream, param, '&')) {
-            size_t equalPos = param.find('=');
-            if (equalPos != std::string::npos) {
-                std::string key = param.substr(0, equalPos);
-                std::string value = param.substr(equalPos + 1);
-                parameters[key] = value;
+parse_status request_parser::parse_chunked(std::string_view buffer) {
+    const char* data = buffer.data();
+    const char* limit = data + buffer.size();
+
+    while (true) {
+        if (current == stage::chunk_size || current == stage::trailers) {
+            const char* eol = find_char(data + position, limit, '\n');
+            if (eol == limit)
+                return buffer.size() - position > MAX_HEAD_SIZE ? parse_status::error : parse_status::need_more;
+
+            size_t line_start = position;
+            size_t line_end = eol - data;
+            if (line_end > line_start && data[line_end - 1] == '\r')
+                line_end--;
+            position = eol - data + 1;
+
+            if (current == stage::trailers) {
+                if (line_end == line_start)
+                    return parse_status::complete; // Trailer fields are skipped
+                continue;
+            }
+
+            // Hexadecimal size, chunk extensions after ';' are ignored
+            size_t size = 0;
+            size_t digits = 0;
+            for (size_t i = line_start; i < line_end && data[i] != ';' && !is_space(data[i]); i++) {
+                char c = lower(data[i]);
+                int digit;
+                if (c >= '0' && c <= '9')
+                    digit = c - '0';
+                else if (c >= 'a' && c <= 'f')
+                    digit = c - 'a' + 10;
+                else
+                    return parse_status::error;
+                if (size > (SIZE_MAX >> 4))
+                    return parse_status::error;
+                size = (size << 4) | digit;
+                digits++;
+            }
+            if (digits == 0)
+                return parse_status::error;
+
+            if (size == 0) {
+                current = stage::trailers;
             } else {
-                parameters[param] = "";
+                if (decoded_body.size() + size > MAX_BODY_SIZE)
+                    return parse_status::too_large;
+                chunk_remaining = size;
+                current = stage::chunk_data;
             }
+        } else if (current == stage::chunk_data) {
+            size_t available = std::min(buffer.size() - position, chunk_remaining);
+            decoded_body.append(data + position, available);
+            position += available;
+            chunk_remaining -= available;
+            if (chunk_remaining > 0)
+                return parse_status::need_more;
+            current = stage::chunk_end;
+        } else {
+            // chunk_end
+            if (position >= buffer.size())
+                return parse_status::need_more;
+            if (data[position] == '\r') {
+                if (position + 1 >= buffer.size())
+                    return parse_status::need_more;
+                position++;
+            }
+            if (data[position] != '\n')
+                return parse_status::error;
+            position++;
+            current = stage::chunk_size;
         }
     }
 }
 
-request parse_request(const std::string& input) {
-    request req;
-    std::istringstream stream(input);
-    std::string line;
-
-    if (getline(stream, line)) {
-        std::istringstream lineStream(line);
-        std::string uri;
-        lineStream >> req.method >> uri >> req.version;
-        req.uri = URI(uri);
-    }
-
-    while (getline(stream, line) && line != "\r") {
-        if (line.empty()) break;
+parse_status request_parser::parse(std::string_view buffer) {
+    const char* data = buffer.data();
+    const char* limit = data + buffer.size();
+
+    while (current != stage::done) {
+        if (current == stage::body) {
+            if (buffer.size() - body_start < content_length)
+                return parse_status::need_more;
+            build_view(buffer, buffer.substr(body_start, content_length), body_start + content_length);
+            current = stage::done;
+            break;
+        }
 
-        if (!line.empty() && line.back() == '\r') {
-            line.pop_back();
+        if (current >= stage::chunk_size) {
+            parse_status status = parse_chunked(buffer);
+            if (status != parse_status::complete)
+                return status;
+            build_view(buffer, decoded_body, position);
+            current = stage::done;
+            break;
         }
 
-        size_t colonPos = line.find(':');
-        if (colonPos != std::string::npos) {
-            std::string key = line.substr(0, colonPos);
-            std::string value = line.substr(colonPos + 2);
+        if (current == stage::request_line) {
+            const char* eol = find_char(data + position, limit, '\n');
+            if (eol == limit)
+                return buffer.size() - start > MAX_HEAD_SIZE ? parse_status::error : parse_status::need_more;
+
+            size_t line_start = position;
+            size_t line_end = eol - data;
+            if (line_end > line_start && data[line_end - 1] == '\r')
+                line_end--;
+            position = eol - data + 1;
 
-            key.erase(0, key.find_first_not_of(" \t"));
-            key.erase(key.find_last_not_of(" \t") + 1);
-            value.erase(0, value.find_first_not_of(" \t"));
-            value.erase(value.find_last_not_of(" \t") + 1);
+            if (line_end == line_start) {
+                start = position; // Tolerate the empty lines some clients send between requests
+                continue;
+            }
 
-            req.headers[key] = value;
+            const char* line_limit = data + line_end;
+            const char* method_end = find_char(data + line_start, line_limit, ' ');
+            if (method_end == line_limit || method_end == data + line_start)
+                return parse_status::error;
+            const char* target_start = method_end;
+            while (target_start < line_limit && *target_start == ' ')
+                target_start++;
+            const char* target_end = find_char(target_start, line_limit, ' ');
+            if (target_start == line_limit || target_end == line_limit)
+                return parse_status::error;
+            const char* version_start = target_end;
+            while (version_start < line_limit && *version_start == ' ')
+                version_start++;
+            if (version_start == line_limit)
+                return parse_status::error;
+
+            method = {line_start, (size_t)(method_end - data) - line_start};
+            target = {(size_t)(target_start - data), (size_t)(target_end - target_start)};
+            version = {(size_t)(version_start - data), (size_t)(line_limit - version_start)};
+            current = stage::headers;
+            continue;
+        }
+
+        // Headers, one pass finds whichever of the colon or the line end comes first
+        size_t line_start = position;
+        const char* delimiter = find_any(data + line_start, limit, ':', '\n');
+        if (delimiter == limit)
+            return buffer.size() - start > MAX_HEAD_SIZE ? parse_status::error : parse_status::need_more;
+
+        if (*delimiter == '\n') {
+            size_t line_end = delimiter - data;
+            if (line_end > line_start && data[line_end - 1] == '\r')
+                line_end--;
+            if (line_end != line_start)
+                return parse_status::error; // A header line without a colon
+
+            position = delimiter - data + 1;
+            body_start = position;
+            if (position - start > MAX_HEAD_SIZE)
+                return parse_status::error;
+            if (chunked && has_content_length)
+                return parse_status::error;
+            if (chunked) {
+                current = stage::chunk_size;
+            } else {
+                if (content_length > MAX_BODY_SIZE)
+                    return parse_status::too_large;
+                current = stage::body;
+            }
+            continue;
         }
-    }
 
-    std::ostringstream bodyStream;
-    bodyStream << stream.rdbuf();
-    req.body = bodyStream.str();
+        const char* eol = find_char(delimiter + 1, limit, '\n');
+        if (eol == limit)
+            return buffer.size() - start > MAX_HEAD_SIZE ? parse_status::error : parse_status::need_more;
+        position = eol - data + 1;
+        // The lines may all end in the buffer, the head as a whole is still capped
+        if (position - start > MAX_HEAD_SIZE)
+            return parse_status::error;
+
+        size_t colon = delimiter - data;
+        if (colon == line_start)
+            return parse_status::error;
+        size_t line_end = eol - data;
+        if (line_end > colon && data[line_end - 1] == '\r')
+            line_end--;
+
+        size_t name_end = colon;
+        while (name_end > line_start && is_space(data[name_end - 1]))
+            name_end--;
+        size_t value_start = colon + 1;
+        while (value_start < line_end && is_space(data[value_start]))
+            value_start++;
+        size_t value_end = line_end;
+        while (value_end > value_start && is_space(data[value_end - 1]))
+            value_end--;
+
+        std::string_view name = buffer.substr(line_start, name_end - line_start);
+        std::string_view value = buffer.substr(value_start, value_end - value_start);
+        parse_status status = parse_header(name, value);
+        if (status != parse_status::complete)
+            return status;
+
+        headers.push_back({{line_start, name_end - line_start}, {value_start, value_end - value_start}});
+    }
 
-    return req;
+    return parse_status::complete;
 }
 
-std::string serialize_response(response& res) {
-    std::ostringstream stream;
-    bool has_body = !res.body.empty();
+parse_status request_parser::finish(std::string_view buffer) {
+    parse_status status = parse(buffer);
+    if (status != parse_status::need_more)
+        return status;
+    if (current != stage::body)
+        return parse_status::error;
 
-    stream << res.version << " " << res.status_code << " " << res.status_message << "\r\n";
+    build_view(buffer, buffer.substr(body_start), buffer.size());
+    current = stage::done;
+    return parse_status::complete;
+}
 
-    if (has_body) {
-        res.headers["Content-length"] = std::to_string(res.body.size());
+void request_parser::build_view(std::string_view buffer, std::string_view body, size_t size) {
+    view.method = buffer.substr(method.offset, method.length);
+    view.verb = parse_verb(view.method);
+    view.target = buffer.substr(target.offset, target.length);
+    view.version = buffer.substr(version.offset, version.length);
+    view.headers.clear();
+    view.headers.reserve(headers.size());
+    for (auto& h: headers) {
+        view.headers.push_back({buffer.substr(h.first.offset, h.first.length),
+                                buffer.substr(h.second.offset, h.second.length)});
     }
+    view.body = body;
+    view.size = size;
+}
+
+request parse_request(const std::string& input) {
+    request_parser parser;
+    if (parser.finish(input) != parse_status::complete)
+        throw std::invalid_argument("Malformed http request");
+    return parser.request().to_request();
+}
+
+// Status lines of every status the helpers below produce, indexed through STATUS_INDEX
+struct status_entry {
+    int code;
+    std::string_view line;
+};
+
+static constexpr status_entry STATUS_LINES[] = {
+    {200, "HTTP/1.1 200 OK\r\n"},
+    {201, "HTTP/1.1 201 Created\r\n"},
+    {202, "HTTP/1.1 202 Accepted\r\n"},
+    {204, "HTTP/1.1 204 No Content\r\n"},
+    {301, "HTTP/1.1 301 Moved Permanently\r\n"},
+    {302, "HTTP/1.1 302 Found\r\n"},
+    {304, "HTTP/1.1 304 Not Modified\r\n"},
+    {307, "HTTP/1.1 307 Temporary Redirect\r\n"},
+    {308, "HTTP/1.1 308 Permanent Redirect\r\n"},
+    {400, "HTTP/1.1 400 Bad Request\r\n"},
+    {401, "HTTP/1.1 401 Unauthorized\r\n"},
+    {403, "HTTP/1.1 403 Forbidden\r\n"},
+    {404, "HTTP/1.1 404 Not Found\r\n"},
+    {405, "HTTP/1.1 405 Method Not Allowed\r\n"},
+    {409, "HTTP/1.1 409 Conflict\r\n"},
+    {413, "HTTP/1.1 413 Payload Too Large\r\n"},
+    {422, "HTTP/1.1 422 Unprocessable Entity\r\n"},
+    {429, "HTTP/1.1 429 Too Many Requests\r\n"},
+    {500, "HTTP/1.1 500 Internal Server Error\r\n"},
+    {501, "HTTP/1.1 501 Not Implemented\r\n"},
+    {502, "HTTP/1.1 502 Bad Gateway\r\n"},
+    {503, "HTTP/1.1 503 Service Unavailable\r\n"},
+    {504, "HTTP/1.1 504 Gateway Timeout\r\n"},
+};
+
+static constexpr int MIN_STATUS = 100;
+static constexpr int MAX_STATUS = 599;
+
+// Status code - MIN_STATUS to the position + 1 of its line in STATUS_LINES, 0 when it has none
+static constexpr auto STATUS_INDEX = []() {
+    std::array<uint8_t, MAX_STATUS - MIN_STATUS + 1> index{};
+    for (size_t i = 0; i < std::size(STATUS_LINES); i++)
+        index[STATUS_LINES[i].code - MIN_STATUS] = (uint8_t)(i + 1);
+    return index;
+}();
+
+// Precomputed status line of res, empty when its version or reason phrase isn't the standard one
+static std::string_view status_line(const response& res) {
+    if (res.status_code < MIN_STATUS || res.status_code > MAX_STATUS)
+        return {};
+    uint8_t position = STATUS_INDEX[res.status_code - MIN_STATUS];
+    if (position == 0)
+        return {};
+
+    std::string_view line = STATUS_LINES[position - 1].line;
+    constexpr size_t prefix = sizeof("HTTP/1.1 200 ") - 1;
+    std::string_view message = line.substr(prefix, line.size() - prefix - 2);
+    if (res.version != "HTTP/1.1" || res.status_message != message)
+        return {};
+    return line;
+}
+
+static void append_number(std::string& out, size_t value) {
+    char digits[20];
+    char* end = digits + sizeof(digits);
+    char* begin = end;
+    do {
+        *--begin = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    out.append(begin, end);
+}
+
+void serialize_head(const response& res, std::string& out) {
+    std::string_view line = status_line(res);
+
+    // Keep-alive clients can only find the end of the response from its length, even an empty one
+    bool bodyless_status = res.status_code < 200 || res.status_code == 204 || res.status_code == 304;
+    bool with_length = !res.body.empty() || !bodyless_status;
+
+    // Sized up front so the head is written with a single allocation
+    size_t size = line.empty() ? res.version.size() + res.status_message.size() + 7 : line.size();
+    for (const auto& header: res.headers)
+        size += header.first.size() + header.second.size() + 4;
+    if (with_length)
+        size += sizeof("Content-Length: \r\n") - 1 + 20;
+    out.reserve(out.size() + size + 2);
 
-    for (const auto& header : res.headers) {
-        stream << header.first << ": " << header.second << "\r\n";
+    if (!line.empty()) {
+        out += line;
+    } else {
+        out += res.version;
+        out += ' ';
+        append_number(out, (size_t)std::max(res.status_code, 0));
+        out += ' ';
+        out += res.status_message;
+        out += "\r\n";
     }
 
-    if (has_body) {
-        stream << "\r\n";
-        stream << res.body;
+    // The length is always the one of the body, whatever the headers say
+    for (const auto& header: res.headers) {
+        if (iequals(header.first, field_name(field::content_length)))
+            continue;
+        out += header.first;
+        out += ": ";
+        out += header.second;
+        out += "\r\n";
+    }
+    if (with_length) {
+        out += "Content-Length: ";
+        append_number(out, res.body.size());
+        out += "\r\n";
     }
+    out += "\r\n";
+}
+
+void serialize_response(const response& res, std::string& out) {
+    serialize_head(res, out);
+    out += res.body;
+}
 
-    return stream.str();
+std::string serialize_response(const response& res) {
+    std::string out;
+    serialize_response(res, out);
+    return out;
 }
 
 response ok() {
@@ -129,18 +551,18 @@ response ok(const nlohmann::json& body) {
     res.status_code = 200;
     res.status_message = "OK";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response ok(const std::string& content_type, const std::string& body) {
+response ok(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 200;
     res.status_message = "OK";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -156,18 +578,18 @@ response created(const nlohmann::json& body) {
     res.status_code = 201;
     res.status_message = "Created";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response created(const std::string& content_type, const std::string& body) {
+response created(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 201;
     res.status_message = "Created";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -183,18 +605,18 @@ response accepted(const nlohmann::json& body) {
     res.status_code = 202;
     res.status_message = "Accepted";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response accepted(const std::string& content_type, const std::string& body) {
+response accepted(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 202;
     res.status_message = "Accepted";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -205,19 +627,19 @@ response no_content() {
     return res;
 }
 
-response moved_permanently(const std::string& location) {
+response moved_permanently(std::string_view location) {
     response res;
     res.status_code = 301;
     res.status_message = "Moved Permanently";
-    res.headers["Location"] = location;
+    res.headers[field::location] = location;
     return res;
 }
 
-response found(const std::string& location) {
+response found(std::string_view location) {
     response res;
     res.status_code = 302;
     res.status_message = "Found";
-    res.headers["Location"] = location;
+    res.headers[field::location] = location;
     return res;
 }
 
@@ -228,19 +650,19 @@ response not_modified() {
     return res;
 }
 
-response temporary_redirect(const std::string& location) {
+response temporary_redirect(std::string_view location) {
     response res;
     res.status_code = 307;
     res.status_message = "Temporary Redirect";
-    res.headers["Location"] = location;
+    res.headers[field::location] = location;
     return res;
 }
 
-response permanent_redirect(const std::string& location) {
+response permanent_redirect(std::string_view location) {
     response res;
     res.status_code = 308;
     res.status_message = "Permanent Redirect";
-    res.headers["Location"] = location;
+    res.headers[field::location] = location;
     return res;
 }
 
@@ -256,18 +678,18 @@ response bad_request(const nlohmann::json& body) {
     res.status_code = 400;
     res.status_message = "Bad Request";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response bad_request(const std::string& content_type, const std::string& body) {
+response bad_request(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 400;
     res.status_message = "Bad Request";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -283,18 +705,18 @@ response unauthorized(const nlohmann::json& body) {
     res.status_code = 401;
     res.status_message = "Unauthorized";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response unauthorized(const std::string& content_type, const std::string& body) {
+response unauthorized(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 401;
     res.status_message = "Unauthorized";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -310,18 +732,18 @@ response forbidden(const nlohmann::json& body) {
     res.status_code = 403;
     res.status_message = "Forbidden";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response forbidden(const std::string& content_type, const std::string& body) {
+response forbidden(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 403;
     res.status_message = "Forbidden";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -337,18 +759,18 @@ response not_found(const nlohmann::json& body) {
     res.status_code = 404;
     res.status_message = "Not Found";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response not_found(const std::string& content_type, const std::string& body) {
+response not_found(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 404;
     res.status_message = "Not Found";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -364,18 +786,18 @@ response method_not_allowed(const nlohmann::json& body) {
     res.status_code = 405;
     res.status_message = "Method Not Allowed";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response method_not_allowed(const std::string& content_type, const std::string& body) {
+response method_not_allowed(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 405;
     res.status_message = "Method Not Allowed";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -391,18 +813,45 @@ response conflict(const nlohmann::json& body) {
     res.status_code = 409;
     res.status_message = "Conflict";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response conflict(const std::string& content_type, const std::string& body) {
+response conflict(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 409;
     res.status_message = "Conflict";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
+    return res;
+}
+
+response payload_too_large() {
+    response res;
+    res.status_code = 413;
+    res.status_message = "Payload Too Large";
+    return res;
+}
+
+response payload_too_large(const nlohmann::json& body) {
+    response res;
+    res.status_code = 413;
+    res.status_message = "Payload Too Large";
+    res.body = body.dump();
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
+    return res;
+}
+
+response payload_too_large(std::string_view content_type, std::string_view body) {
+    response res;
+    res.status_code = 413;
+    res.status_message = "Payload Too Large";
+    res.body = body;
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -418,18 +867,18 @@ response unprocessable_entity(const nlohmann::json& body) {
     res.status_code = 422;
     res.status_message = "Unprocessable Entity";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response unprocessable_entity(const std::string& content_type, const std::string& body) {
+response unprocessable_entity(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 422;
     res.status_message = "Unprocessable Entity";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -445,18 +894,18 @@ response too_many_requests(const nlohmann::json& body) {
     res.status_code = 429;
     res.status_message = "Too Many Requests";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response too_many_requests(const std::string& content_type, const std::string& body) {
+response too_many_requests(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 429;
     res.status_message = "Too Many Requests";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -472,18 +921,18 @@ response internal_server_error(const nlohmann::json& body) {
     res.status_code = 500;
     res.status_message = "Internal Server Error";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response internal_server_error(const std::string& content_type, const std::string& body) {
+response internal_server_error(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 500;
     res.status_message = "Internal Server Error";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -499,18 +948,18 @@ response not_implemented(const nlohmann::json& body) {
     res.status_code = 501;
     res.status_message = "Not Implemented";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response not_implemented(const std::string& content_type, const std::string& body) {
+response not_implemented(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 501;
     res.status_message = "Not Implemented";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -526,18 +975,18 @@ response bad_gateway(const nlohmann::json& body) {
     res.status_code = 502;
     res.status_message = "Bad Gateway";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response bad_gateway(const std::string& content_type, const std::string& body) {
+response bad_gateway(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 502;
     res.status_message = "Bad Gateway";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -553,18 +1002,18 @@ response service_unavailable(const nlohmann::json& body) {
     res.status_code = 503;
     res.status_message = "Service Unavailable";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response service_unavailable(const std::string& content_type, const std::string& body) {
+response service_unavailable(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 503;
     res.status_message = "Service Unavailable";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -580,18 +1029,18 @@ response gateway_timeout(const nlohmann::json& body) {
     res.status_code = 504;
     res.status_message = "Gateway Timeout";
     res.body = body.dump();
-    res.headers["Content-Type"] = "application/json";
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = "application/json";
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
-response gateway_timeout(const std::string& content_type, const std::string& body) {
+response gateway_timeout(std::string_view content_type, std::string_view body) {
     response res;
     res.status_code = 504;
     res.status_message = "Gateway Timeout";
     res.body = body;
-    res.headers["Content-Type"] = content_type;
-    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers[field::content_type] = content_type;
+    res.headers[field::content_length] = std::to_string(res.body.size());
     return res;
 }
 
@@ -0,0 +1,124 @@
+#include "http_scan.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86 1
+#endif
+
+namespace http {
+
+static const char* find_char_scalar(const char* begin, const char* end, char c) {
+    const void* p = std::memchr(begin, c, end - begin);
+    return p != nullptr ? (const char*)p : end;
+}
+
+static const char* find_any_scalar(const char* begin, const char* end, char a, char b) {
+    for (const char* p = begin; p < end; p++) {
+        if (*p == a || *p == b)
+            return p;
+    }
+    return end;
+}
+
+#ifdef HTTP_SCAN_X86
+
+__attribute__((target("avx2")))
+static const char* find_char_avx2(const char* begin, const char* end, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    const char* p = begin;
+    for (; p + 32 <= end; p += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)p);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+    return find_char_scalar(p, end, c);
+}
+
+__attribute__((target("avx2")))
+static const char* find_any_avx2(const char* begin, const char* end, char a, char b) {
+    const __m256i first = _mm256_set1_epi8(a);
+    const __m256i second = _mm256_set1_epi8(b);
+    const char* p = begin;
+    for (; p + 32 <= end; p += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(block, first), _mm256_cmpeq_epi8(block, second));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+    return find_any_scalar(p, end, a, b);
+}
+
+__attribute__((target("sse4.2")))
+static const char* find_char_sse42(const char* begin, const char* end, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    const char* p = begin;
+    for (; p + 16 <= end; p += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)p);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+    return find_char_scalar(p, end, c);
+}
+
+// PCMPESTRI compares each of the 16 bytes against the whole delimiter set in one instruction
+__attribute__((target("sse4.2")))
+static const char* find_any_sse42(const char* begin, const char* end, char a, char b) {
+    const __m128i set = _mm_setr_epi8(a, b, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const char* p = begin;
+    for (; p + 16 <= end; p += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)p);
+        int index = _mm_cmpestri(set, 2, block, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16)
+            return p + index;
+    }
+    return find_any_scalar(p, end, a, b);
+}
+
+#endif // HTTP_SCAN_X86
+
+using find_char_fn = const char* (*)(const char*, const char*, char);
+using find_any_fn = const char* (*)(const char*, const char*, char, char);
+
+struct scan_kernel_set {
+    find_char_fn find_char;
+    find_any_fn find_any;
+    const char* name;
+};
+
+static scan_kernel_set select_kernels() {
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {find_char_avx2, find_any_avx2, "avx2"};
+    if (__builtin_cpu_supports("sse4.2"))
+        return {find_char_sse42, find_any_sse42, "sse4.2"};
+#endif
+    return {find_char_scalar, find_any_scalar, "scalar"};
+}
+
+static const scan_kernel_set detected_kernels = select_kernels();
+static const scan_kernel_set scalar_kernels = {find_char_scalar, find_any_scalar, "scalar"};
+static const scan_kernel_set* kernels = &detected_kernels;
+
+const char* find_char(const char* begin, const char* end, char c) {
+    return kernels->find_char(begin, end, c);
+}
+
+const char* find_any(const char* begin, const char* end, char a, char b) {
+    return kernels->find_any(begin, end, a, b);
+}
+
+const char* scan_kernels() {
+    return kernels->name;
+}
+
+void use_scalar_scan(bool scalar) {
+    kernels = scalar ? &scalar_kernels : &detected_kernels;
+}
+
+}
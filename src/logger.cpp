@@ -0,0 +1,283 @@
+#include "logger.h"
+#include "coarse_clock.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+Logger::producer::~producer() {
+    if (queue)
+        queue->retired.store(true, std::memory_order_release);
+}
+
+Logger::Logger() {
+    // Constructed first so it is destroyed last, the records are stamped with it
+    CoarseClock::instance();
+    buffer.reserve(64 * 1024);
+    thread = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wake_cv.notify_one();
+    thread.join();
+    if (fd != 1)
+        close(fd);
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+void Logger::use_level(log_level min_level) {
+    level.store(min_level, std::memory_order_relaxed);
+}
+
+void Logger::use_sampling(unsigned every) {
+    sample_every.store(std::max(every, 1u), std::memory_order_relaxed);
+}
+
+void Logger::use_output(const std::string& path) {
+    int next = 1;
+    if (!path.empty()) {
+        next = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (next == -1)
+            throw std::runtime_error("Failed to open the log file " + path);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd != 1)
+        close(fd);
+    fd = next;
+}
+
+Logger::producer& Logger::local() {
+    static thread_local producer p;
+    return p;
+}
+
+Logger::ring& Logger::local_ring() {
+    producer& p = local();
+    if (!p.queue) {
+        p.queue = std::make_shared<ring>();
+        std::lock_guard<std::mutex> lock(mutex);
+        rings.push_back(p.queue);
+    }
+    return *p.queue;
+}
+
+void Logger::push(const log_record& record) {
+    ring& r = local_ring();
+    size_t head = r.head.load(std::memory_order_relaxed);
+    size_t tail = r.tail.load(std::memory_order_acquire);
+    if (head - tail == RING_SIZE) {
+        r.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    r.records[head & (RING_SIZE - 1)] = record;
+    r.head.store(head + 1, std::memory_order_release);
+
+    // Drained early rather than dropping under a burst, once per half ring
+    if (head + 1 - tail == RING_SIZE / 2)
+        wake_cv.notify_one();
+}
+
+static uint8_t copy_field(char* destination, size_t capacity, std::string_view value) {
+    size_t size = std::min(value.size(), capacity);
+    std::memcpy(destination, value.data(), size);
+    return (uint8_t)size;
+}
+
+// Copies the preformatted time of the clock, the writer may get to the record a little later
+static void stamp(log_record& record) {
+    std::memcpy(record.time, CoarseClock::instance().log_time().data(), sizeof(record.time));
+}
+
+void Logger::log(log_level record_level, log_event event, std::string_view ip, std::string_view text) {
+    if (!enabled(record_level))
+        return;
+    unsigned every = sample_every.load(std::memory_order_relaxed);
+    if (every > 1 && record_level <= log_level::info && ++local().sampled % every != 0)
+        return;
+
+    log_record record;
+    stamp(record);
+    record.latency_us = 0;
+    record.bytes = 0;
+    record.status = 0;
+    record.event = event;
+    record.level = record_level;
+    record.ip_size = copy_field(record.ip, sizeof(record.ip), ip);
+    record.method_size = 0;
+    record.text_size = copy_field(record.text, sizeof(record.text), text);
+    push(record);
+}
+
+void Logger::message(log_level record_level, std::string_view text) {
+    log(record_level, log_event::message, {}, text);
+}
+
+void Logger::access(std::string_view ip, std::string_view method, std::string_view route, int status, size_t bytes,
+                    std::chrono::steady_clock::duration latency) {
+    if (!enabled(log_level::info))
+        return;
+    unsigned every = sample_every.load(std::memory_order_relaxed);
+    if (every > 1 && ++local().sampled % every != 0)
+        return;
+
+    log_record record;
+    stamp(record);
+    record.latency_us = (uint32_t)std::min<long long>(
+        std::chrono::duration_cast<std::chrono::microseconds>(latency).count(), UINT32_MAX);
+    record.bytes = (uint32_t)std::min<size_t>(bytes, UINT32_MAX);
+    record.status = (uint16_t)status;
+    record.event = log_event::access;
+    record.level = log_level::info;
+    record.ip_size = copy_field(record.ip, sizeof(record.ip), ip);
+    record.method_size = copy_field(record.method, sizeof(record.method), method);
+    record.text_size = copy_field(record.text, sizeof(record.text), route);
+    push(record);
+}
+
+void Logger::format(const log_record& record) {
+    std::string_view ip(record.ip, record.ip_size);
+    std::string_view text(record.text, record.text_size);
+
+    buffer += '[';
+    buffer.append(record.time, sizeof(record.time));
+    buffer += "] ";
+    switch (record.event) {
+    case log_event::connected:
+        buffer += "Client connected: ";
+        buffer += ip;
+        break;
+    case log_event::disconnected:
+        buffer += "Client disconnected: ";
+        buffer += ip;
+        break;
+    case log_event::access: {
+        char numbers[64];
+        std::snprintf(numbers, sizeof(numbers), " %u %u bytes %u.%03u ms", record.status, record.bytes,
+                      record.latency_us / 1000, record.latency_us % 1000);
+        buffer += "Client: ";
+        buffer += ip;
+        buffer += ' ';
+        buffer.append(record.method, record.method_size);
+        buffer += ' ';
+        buffer += text;
+        buffer += numbers;
+        break;
+    }
+    case log_event::malformed:
+        buffer += "Client: ";
+        buffer += ip;
+        buffer += " sent a malformed request";
+        break;
+    case log_event::too_large:
+        buffer += "Client: ";
+        buffer += ip;
+        buffer += " sent a too large request";
+        break;
+    case log_event::tls_failed:
+        buffer += "Failed to establish tls connection with client: ";
+        buffer += ip;
+        break;
+    case log_event::client_error:
+        buffer += "Error with client: ";
+        buffer += ip;
+        break;
+    case log_event::message:
+        buffer += text;
+        break;
+    }
+    // Detail of a connection event
+    if (record.event != log_event::message && record.event != log_event::access && !text.empty()) {
+        buffer += " (";
+        buffer += text;
+        buffer += ')';
+    }
+    buffer += '\n';
+}
+
+void Logger::drain() {
+    std::vector<std::shared_ptr<ring>> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        snapshot = rings;
+    }
+
+    uint64_t dropped = 0;
+    std::vector<ring*> finished;
+    for (const std::shared_ptr<ring>& r: snapshot) {
+        // Read before the records, every record of a retired ring is then visible below
+        bool retired = r->retired.load(std::memory_order_acquire);
+        size_t tail = r->tail.load(std::memory_order_relaxed);
+        size_t head = r->head.load(std::memory_order_acquire);
+        for (; tail != head; tail++)
+            format(r->records[tail & (RING_SIZE - 1)]);
+        r->tail.store(tail, std::memory_order_release);
+        dropped += r->dropped.exchange(0, std::memory_order_relaxed);
+        if (retired)
+            finished.push_back(r.get());
+    }
+    if (dropped > 0) {
+        log_record record{};
+        stamp(record);
+        record.event = log_event::message;
+        std::string text = std::to_string(dropped) + " log records dropped";
+        record.text_size = copy_field(record.text, sizeof(record.text), text);
+        format(record);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!finished.empty()) {
+        rings.erase(std::remove_if(rings.begin(), rings.end(), [&finished](const std::shared_ptr<ring>& r) {
+            return std::find(finished.begin(), finished.end(), r.get()) != finished.end();
+        }), rings.end());
+    }
+
+    // Written under the lock so use_output can't close the descriptor in the middle
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t bytes = write(fd, buffer.data() + written, buffer.size() - written);
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            break;
+        written += bytes;
+    }
+    buffer.clear();
+}
+
+void Logger::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        wake_cv.wait_for(lock, DRAIN_INTERVAL);
+        lock.unlock();
+        drain();
+        lock.lock();
+        passes++;
+        drained_cv.notify_all();
+    }
+    // What the threads pushed before the shutdown still goes out
+    lock.unlock();
+    drain();
+    lock.lock();
+    passes++;
+    drained_cv.notify_all();
+}
+
+void Logger::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    // The pass in progress may have started before the last records, the one after it can't have
+    uint64_t target = passes + 2;
+    wake_cv.notify_one();
+    drained_cv.wait(lock, [this, target]() { return passes >= target || !running; });
+}
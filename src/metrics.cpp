@@ -0,0 +1,258 @@
+#include "metrics.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+
+// Upper bounds of the Prometheus buckets, in microseconds
+static constexpr uint64_t EXPOSED_BOUNDS[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+                                              100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000};
+static constexpr double EXPOSED_QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+static constexpr std::string_view OVERFLOW_ROUTE = "<overflow>";
+
+int latency_histogram::bucket(uint64_t us) {
+    if (us < SUB_BUCKETS)
+        return (int)us;
+    if (us >> 32)
+        return BUCKETS - 1;
+    int exponent = 63 - __builtin_clzll(us);
+    int sub = (int)(us >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t latency_histogram::upper_bound(int bucket) {
+    if (bucket < SUB_BUCKETS)
+        return (uint64_t)bucket;
+    int exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    int sub = bucket % SUB_BUCKETS;
+    uint64_t width = 1ULL << (exponent - SUB_BUCKET_BITS);
+    return ((uint64_t)(SUB_BUCKETS + sub) << (exponent - SUB_BUCKET_BITS)) + width - 1;
+}
+
+void latency_histogram::record(uint64_t us) {
+    std::atomic<uint64_t>& b = buckets[bucket(us)];
+    b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sum_us.store(sum_us.load(std::memory_order_relaxed) + us, std::memory_order_relaxed);
+    // Last, the exposition may see a bucket without its count but never a count without its bucket
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+Metrics::shard::~shard() {
+    for (series& s: table)
+        delete s.histogram.load(std::memory_order_relaxed);
+}
+
+latency_histogram& Metrics::shard::find(std::string_view route, int status) {
+    size_t slots = SERIES - 1;
+    size_t index = (std::hash<std::string_view>{}(route) ^ ((size_t)status * 0x9e3779b97f4a7c15ULL)) % slots;
+    for (size_t probe = 0; probe < slots; probe++) {
+        series& s = table[(index + probe) % slots];
+        latency_histogram* histogram = s.histogram.load(std::memory_order_relaxed);
+        if (histogram == nullptr) {
+            // Only this thread writes the table, the key is set before the series is published
+            s.route = route;
+            s.status = status;
+            histogram = new latency_histogram();
+            s.histogram.store(histogram, std::memory_order_release);
+            return *histogram;
+        }
+        if (s.status == status && s.route == route)
+            return *histogram;
+    }
+
+    series& overflow = table[SERIES - 1];
+    latency_histogram* histogram = overflow.histogram.load(std::memory_order_relaxed);
+    if (histogram == nullptr) {
+        overflow.route = OVERFLOW_ROUTE;
+        histogram = new latency_histogram();
+        overflow.histogram.store(histogram, std::memory_order_release);
+    }
+    return *histogram;
+}
+
+Metrics::owner::~owner() {
+    if (data)
+        data->retired.store(true, std::memory_order_release);
+}
+
+void Metrics::totals::add(const shard& s) {
+    for (const series& entry: s.table) {
+        const latency_histogram* histogram = entry.histogram.load(std::memory_order_acquire);
+        if (histogram == nullptr)
+            continue;
+        counts& c = latencies[{entry.route, entry.status}];
+        c.count += histogram->count.load(std::memory_order_acquire);
+        c.sum_us += histogram->sum_us.load(std::memory_order_relaxed);
+        for (int i = 0; i < latency_histogram::BUCKETS; i++)
+            c.buckets[i] += histogram->buckets[i].load(std::memory_order_relaxed);
+    }
+    bytes_in += s.bytes_in.load(std::memory_order_relaxed);
+    bytes_out += s.bytes_out.load(std::memory_order_relaxed);
+    parse_errors += s.parse_errors.load(std::memory_order_relaxed);
+    tls_failures += s.tls_failures.load(std::memory_order_relaxed);
+    connections_opened += s.connections_opened.load(std::memory_order_relaxed);
+    connections_closed += s.connections_closed.load(std::memory_order_relaxed);
+    connections_shed += s.connections_shed.load(std::memory_order_relaxed);
+    requests_shed += s.requests_shed.load(std::memory_order_relaxed);
+}
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::owner& Metrics::local_owner() {
+    static thread_local owner o;
+    return o;
+}
+
+Metrics::shard& Metrics::local() {
+    owner& o = local_owner();
+    if (!o.data) {
+        o.data = std::make_shared<shard>();
+        std::lock_guard<std::mutex> lock(mutex);
+        // A new thread is the moment to reclaim the shards of the exited ones, one per connection when threaded
+        fold_retired();
+        shards.push_back(o.data);
+    }
+    return *o.data;
+}
+
+void Metrics::fold_retired() {
+    auto end = std::remove_if(shards.begin(), shards.end(), [this](const std::shared_ptr<shard>& s) {
+        if (!s->retired.load(std::memory_order_acquire))
+            return false;
+        retired.add(*s);
+        return true;
+    });
+    shards.erase(end, shards.end());
+}
+
+void Metrics::request(std::string_view route, int status, std::chrono::steady_clock::duration latency) {
+    long long us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    local().find(route, status).record((uint64_t)std::max(us, 0LL));
+}
+
+// Label values escape the backslash, the double quote and the line feed
+static void append_label(std::string& out, std::string_view value) {
+    for (char c: value) {
+        if (c == '\\' || c == '"')
+            out += '\\';
+        if (c == '\n') {
+            out += "\\n";
+            continue;
+        }
+        out += c;
+    }
+}
+
+static void append_seconds(std::string& out, double us) {
+    char number[32];
+    std::snprintf(number, sizeof(number), "%.6f", us / 1e6);
+    out += number;
+}
+
+static void append_counter(std::string& out, const char* name, const char* type, const char* help, uint64_t value) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+    out += name;
+    out += ' ';
+    out += std::to_string(value);
+    out += '\n';
+}
+
+std::string Metrics::expose() {
+    totals sum;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fold_retired();
+        sum = retired;
+        for (const std::shared_ptr<shard>& s: shards)
+            sum.add(*s);
+    }
+
+    std::string out;
+    out.reserve(4096 + sum.latencies.size() * 2048);
+
+    out += "# HELP cpphttp_request_duration_seconds Time spent building the responses, by route and status\n"
+           "# TYPE cpphttp_request_duration_seconds histogram\n";
+    for (const auto& entry: sum.latencies) {
+        std::string labels = "route=\"";
+        append_label(labels, entry.first.first);
+        labels += "\",status=\"";
+        labels += std::to_string(entry.first.second);
+        labels += '"';
+
+        const totals::counts& c = entry.second;
+        uint64_t cumulative = 0;
+        int bucket = 0;
+        for (uint64_t bound: EXPOSED_BOUNDS) {
+            // A bucket straddling the bound is counted above it, within the histogram precision
+            while (bucket < latency_histogram::BUCKETS && latency_histogram::upper_bound(bucket) <= bound)
+                cumulative += c.buckets[bucket++];
+            out += "cpphttp_request_duration_seconds_bucket{" + labels + ",le=\"";
+            append_seconds(out, (double)bound);
+            out += "\"} " + std::to_string(cumulative) + '\n';
+        }
+        out += "cpphttp_request_duration_seconds_bucket{" + labels + ",le=\"+Inf\"} " + std::to_string(c.count) + '\n';
+        out += "cpphttp_request_duration_seconds_sum{" + labels + "} ";
+        append_seconds(out, (double)c.sum_us);
+        out += "\ncpphttp_request_duration_seconds_count{" + labels + "} " + std::to_string(c.count) + '\n';
+    }
+
+    out += "# HELP cpphttp_request_latency_seconds Quantiles of the time spent building the responses since the start\n"
+           "# TYPE cpphttp_request_latency_seconds summary\n";
+    for (const auto& entry: sum.latencies) {
+        std::string labels = "route=\"";
+        append_label(labels, entry.first.first);
+        labels += "\",status=\"";
+        labels += std::to_string(entry.first.second);
+        labels += '"';
+
+        const totals::counts& c = entry.second;
+        for (double quantile: EXPOSED_QUANTILES) {
+            // Highest value of the bucket holding the rank, as HdrHistogram reports it
+            uint64_t rank = (uint64_t)(quantile * (double)c.count + 0.5);
+            uint64_t seen = 0;
+            int bucket = 0;
+            for (; bucket < latency_histogram::BUCKETS - 1; bucket++) {
+                seen += c.buckets[bucket];
+                if (seen >= std::max<uint64_t>(rank, 1))
+                    break;
+            }
+            char q[16];
+            std::snprintf(q, sizeof(q), "%g", quantile);
+            out += "cpphttp_request_latency_seconds{" + labels + ",quantile=\"" + q + "\"} ";
+            append_seconds(out, c.count == 0 ? 0.0 : (double)latency_histogram::upper_bound(bucket));
+            out += '\n';
+        }
+        out += "cpphttp_request_latency_seconds_sum{" + labels + "} ";
+        append_seconds(out, (double)c.sum_us);
+        out += "\ncpphttp_request_latency_seconds_count{" + labels + "} " + std::to_string(c.count) + '\n';
+    }
+
+    append_counter(out, "cpphttp_connections_active", "gauge", "Connections currently open",
+                   sum.connections_opened - std::min(sum.connections_closed, sum.connections_opened));
+    append_counter(out, "cpphttp_connections_total", "counter", "Connections accepted", sum.connections_opened);
+    append_counter(out, "cpphttp_received_bytes_total", "counter", "Bytes of the parsed requests", sum.bytes_in);
+    append_counter(out, "cpphttp_sent_bytes_total", "counter", "Bytes of the responses", sum.bytes_out);
+    append_counter(out, "cpphttp_parse_errors_total", "counter", "Requests rejected by the parser", sum.parse_errors);
+    append_counter(out, "cpphttp_tls_handshake_failures_total", "counter", "Failed TLS handshakes", sum.tls_failures);
+    append_counter(out, "cpphttp_shed_connections_total", "counter", "Connections refused over the connection limit",
+                   sum.connections_shed);
+    append_counter(out, "cpphttp_shed_requests_total", "counter", "Requests refused over the concurrency limit",
+                   sum.requests_shed);
+    int current_limit = limit.load(std::memory_order_relaxed);
+    if (current_limit >= 0)
+        append_counter(out, "cpphttp_concurrency_limit", "gauge", "Requests admitted in the controllers at once",
+                       (uint64_t)current_limit);
+    return out;
+}
@@ -0,0 +1,155 @@
+#include "router.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+Router::Router() {
+    nodes.emplace_back();
+    compile();
+}
+
+void Router::add(const std::string& route, Controller* controller, unsigned verbs) {
+    int index = 0;
+    std::vector<std::string> capture_names;
+    std::vector<size_t> capture_depths;
+    size_t depth = 0;
+
+    size_t start = 0;
+    while (start <= route.size()) {
+        size_t end = route.find('/', start);
+        if (end == std::string::npos)
+            end = route.size();
+        std::string segment = route.substr(start, end - start);
+        start = end + 1;
+        if (segment.empty())
+            continue; // leading, trailing or doubled slashes
+
+        if (segment[0] == ':') {
+            capture_names.push_back(segment.substr(1));
+            capture_depths.push_back(depth);
+            if (nodes[index].capture < 0) {
+                nodes[index].capture = (int)nodes.size();
+                nodes.emplace_back();
+            }
+            index = nodes[index].capture;
+        } else {
+            auto it = nodes[index].children.find(segment);
+            if (it == nodes[index].children.end()) {
+                int child = (int)nodes.size();
+                nodes[index].children.emplace(segment, child);
+                nodes.emplace_back();
+                index = child;
+            } else {
+                index = it->second;
+            }
+        }
+        depth++;
+    }
+
+    nodes[index].controller = controller;
+    nodes[index].verbs = verbs;
+    nodes[index].capture_names = std::move(capture_names);
+    nodes[index].capture_depths = std::move(capture_depths);
+    compile();
+}
+
+void Router::clear() {
+    nodes.clear();
+    nodes.emplace_back();
+    compile();
+}
+
+void Router::compile() {
+    // Preorder rank with the static children before the capture, of two routes matching the same path
+    // the one with a static segment where the other captures ranks first
+    std::vector<int> rank(nodes.size());
+    int next_rank = 0;
+    std::vector<int> pending{0};
+    while (!pending.empty()) {
+        int index = pending.back();
+        pending.pop_back();
+        rank[index] = next_rank++;
+        if (nodes[index].capture >= 0)
+            pending.push_back(nodes[index].capture);
+        for (const auto& child: nodes[index].children)
+            pending.push_back(child.second);
+    }
+
+    // Subset construction, the nodes of a state are all at the same depth
+    states.clear();
+    std::map<std::vector<int>, int> ids;
+    std::vector<std::vector<int>> members;
+    auto state_of = [&](std::vector<int> set) {
+        if (set.empty())
+            return -1;
+        std::sort(set.begin(), set.end());
+        auto found = ids.emplace(set, (int)states.size());
+        if (found.second) {
+            states.emplace_back();
+            members.push_back(std::move(set));
+        }
+        return found.first->second;
+    };
+    state_of({0});
+
+    for (size_t current = 0; current < states.size(); current++) {
+        std::vector<int> set = members[current];
+        std::vector<int> captures;
+        int route = -1;
+        for (int index: set) {
+            if (nodes[index].capture >= 0)
+                captures.push_back(nodes[index].capture);
+            if (nodes[index].controller != nullptr && (route < 0 || rank[index] < rank[route]))
+                route = index;
+        }
+
+        segment_map next;
+        for (int index: set) {
+            for (const auto& child: nodes[index].children) {
+                if (next.count(child.first) != 0)
+                    continue;
+                // A static segment leads to the nodes having it and to every capture
+                std::vector<int> target = captures;
+                for (int other: set) {
+                    auto it = nodes[other].children.find(child.first);
+                    if (it != nodes[other].children.end())
+                        target.push_back(it->second);
+                }
+                next.emplace(child.first, state_of(std::move(target)));
+            }
+        }
+        int other = state_of(std::move(captures));
+
+        // states grows while the targets are added, it is indexed again
+        states[current].next = std::move(next);
+        states[current].other = other;
+        states[current].route = route;
+    }
+}
+
+Controller* Router::match(const std::pmr::vector<std::pmr::string>& path,
+                          std::pmr::map<std::pmr::string, std::pmr::string>& params, unsigned& verbs) const {
+    // The last state passed with a route holds the deepest one
+    int current = 0;
+    int best = states[0].route;
+    for (const std::pmr::string& segment: path) {
+        const state& at = states[current];
+        auto it = at.next.find(std::string_view(segment));
+        current = it != at.next.end() ? it->second : at.other;
+        if (current < 0)
+            break;
+        if (states[current].route >= 0)
+            best = states[current].route;
+    }
+    if (best < 0)
+        return nullptr;
+
+    const node& found = nodes[best];
+    for (size_t i = 0; i < found.capture_names.size(); i++)
+        params.insert_or_assign(std::pmr::string(found.capture_names[i], params.get_allocator()),
+                                path[found.capture_depths[i]]);
+    verbs = found.verbs;
+    return found.controller;
+}
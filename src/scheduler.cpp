@@ -0,0 +1,180 @@
+#include "scheduler.h"
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <cerrno>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <mutex>
+#include <stdexcept>
+
+static constexpr uint64_t WAKE_TAG = 0; // epoll data of the wake up event, coroutine handles are never null
+
+Scheduler::Scheduler() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+        throw std::runtime_error("Failed to create the scheduler epoll instance");
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd == -1) {
+        close(epoll_fd);
+        throw std::runtime_error("Failed to create the scheduler wake up event");
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = WAKE_TAG;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+    thread = std::thread(&Scheduler::run, this);
+}
+
+Scheduler::~Scheduler() {
+    // The coroutines still suspended are left as they are, their owners are gone with the process
+    running = false;
+    uint64_t value = 1;
+    write(wake_fd, &value, sizeof(value));
+    thread.join();
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+Scheduler& Scheduler::instance() {
+    static Scheduler scheduler;
+    return scheduler;
+}
+
+void Scheduler::resume_at(std::chrono::steady_clock::time_point deadline, std::coroutine_handle<> handle) {
+    bool earliest;
+    {
+        std::lock_guard<std::mutex> lock(timers_mutex);
+        earliest = timers.empty() || deadline < timers.top().deadline;
+        timers.push({deadline, handle});
+    }
+    // The loop sleeps until the previous first deadline, it must recompute its timeout
+    if (earliest) {
+        uint64_t value = 1;
+        write(wake_fd, &value, sizeof(value));
+    }
+}
+
+bool Scheduler::resume_on(int fd, uint32_t events, std::coroutine_handle<> handle) {
+    // One shot, the fd stays registered but disarmed after it fires and is re-armed by the next wait
+    epoll_event ev{};
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = handle.address();
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+        return true;
+    if (errno != ENOENT)
+        return false;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+ThreadPool& Scheduler::pool() {
+    std::call_once(blocking_once, [this]() {
+        blocking = std::make_unique<ThreadPool>();
+    });
+    return *blocking;
+}
+
+void Scheduler::run() {
+    constexpr int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+    std::vector<std::coroutine_handle<>> expired;
+
+    while (running) {
+        int timeout = -1;
+        {
+            std::lock_guard<std::mutex> lock(timers_mutex);
+            if (!timers.empty()) {
+                auto left = timers.top().deadline - std::chrono::steady_clock::now();
+                // Rounded up, waking before the deadline would only spin
+                timeout = (int)std::max<long long>(0, std::chrono::ceil<std::chrono::milliseconds>(left).count());
+            }
+        }
+
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if (count == -1 && errno != EINTR)
+            break;
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.u64 == WAKE_TAG) {
+                uint64_t value;
+                read(wake_fd, &value, sizeof(value));
+                continue;
+            }
+            std::coroutine_handle<>::from_address(events[i].data.ptr).resume();
+        }
+
+        // Resumed outside the lock, a coroutine is free to start another timer
+        auto now = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(timers_mutex);
+            while (!timers.empty() && timers.top().deadline <= now) {
+                expired.push_back(timers.top().handle);
+                timers.pop();
+            }
+        }
+        for (std::coroutine_handle<> handle: expired)
+            handle.resume();
+        expired.clear();
+    }
+}
+
+namespace async {
+
+task<ssize_t> read(int fd, void* buffer, size_t size) {
+    while (true) {
+        ssize_t bytes_read = ::read(fd, buffer, size);
+        if (bytes_read >= 0)
+            co_return bytes_read;
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            co_return -1;
+        if (!co_await readable(fd))
+            co_return -1;
+    }
+}
+
+task<ssize_t> write(int fd, const void* buffer, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        ssize_t bytes_written = ::send(fd, (const char*)buffer + written, size - written, MSG_NOSIGNAL);
+        if (bytes_written >= 0) {
+            written += bytes_written;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            co_return -1;
+        if (!co_await writable(fd))
+            co_return -1;
+    }
+    co_return (ssize_t)written;
+}
+
+task<int> connect(int fd, const sockaddr* address, socklen_t length) {
+    if (::connect(fd, address, length) == 0)
+        co_return 0;
+    if (errno != EINPROGRESS)
+        co_return -1;
+    if (!co_await writable(fd))
+        co_return -1;
+
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_length) == -1)
+        co_return -1;
+    if (error != 0) {
+        errno = error;
+        co_return -1;
+    }
+    co_return 0;
+}
+
+}
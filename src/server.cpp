@@ -3,9 +3,16 @@
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <climits>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <thread>
+#include <pthread.h>
+#include <sched.h>
 
 #include <iostream>
 
@@ -17,6 +24,8 @@
 #include <string>
 #include <memory>
 #include <mutex>
+#include <chrono>
+#include <optional>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -25,35 +34,108 @@
 #include "controller.h"
 #include "ssl.h"
 #include "helpers.h"
+#include "uring.h"
+#include "compression.h"
+#include "scheduler.h"
 
 #define BUFFER_SIZE 16384
 
+// epoll tags of the non client events, client events carry the connection id
+static constexpr uint64_t LISTEN_EVENT = UINT64_MAX;
+static constexpr uint64_t WAKE_EVENT = UINT64_MAX - 1;
+
+// io_uring operations, packed with the connection id in the user data of each request
+enum ring_op : uint64_t {
+    RING_ACCEPT,
+    RING_RECV,
+    RING_SEND,
+    RING_SHUTDOWN,
+    RING_CLOSE,
+    RING_WAKE,
+    RING_TIMER,
+};
+
+static constexpr unsigned RING_ENTRIES = 1024;
+static constexpr unsigned RING_BUFFERS = 256; // provided receive buffers of BUFFER_SIZE bytes per ring
+static constexpr uint16_t RING_BUFFER_GROUP = 0;
+
+static inline uint64_t ring_data(uint64_t id, ring_op op) {
+    return id << 8 | op;
+}
+
+static __kernel_timespec ring_sweep_interval{1, 0};
+
+static void arm_accept(IoUring& ring, int listen_fd) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = ring_data(0, RING_ACCEPT);
+}
+
+static void arm_recv(IoUring& ring, int client_fd, uint64_t id) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client_fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RING_BUFFER_GROUP;
+    sqe->user_data = ring_data(id, RING_RECV);
+}
+
+static void arm_wake(IoUring& ring, int wake_fd, uint64_t* value) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_fd;
+    sqe->addr = (uint64_t)value;
+    sqe->len = sizeof(*value);
+    sqe->user_data = ring_data(0, RING_WAKE);
+}
+
+static void arm_timer(IoUring& ring) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)&ring_sweep_interval;
+    sqe->len = 1;
+    sqe->user_data = ring_data(0, RING_TIMER);
+}
+
 namespace fs = std::filesystem;
 
-Server::Server(const std::string& host, uint16_t port) {
+// Creates a socket bound to the address, SO_REUSEPORT lets several of them share the same port
+static int create_listener(const sockaddr_in& address) {
     int server_fd;
-    struct sockaddr_in address;
     int opt = 1;
 
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
         throw std::runtime_error("Failed to create socket");
     }
 
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT,
-                   &opt, sizeof(opt))) {
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
+        close(server_fd);
         throw std::runtime_error("Failed to set port");
     }
 
+    if (bind(server_fd, (struct sockaddr*)&address, sizeof(struct sockaddr))) {
+        close(server_fd);
+        throw std::runtime_error("Bind failed");
+    }
+
+    return server_fd;
+}
+
+Server::Server(const std::string& host, uint16_t port, io_mode mode, int io_threads):
+    mode(mode), io_threads(io_threads) {
+    struct sockaddr_in address;
+
     address.sin_family = AF_INET;
     if ((address.sin_addr.s_addr = inet_addr(host.c_str())) == INADDR_NONE)
         throw std::invalid_argument("Invalid IP address: " + host);
     address.sin_port = htons(port);
 
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(struct sockaddr))) {
-        throw std::runtime_error("Bind failed");
-    }
-
-    fd = server_fd;
+    fd = create_listener(address);
     this->address = address;
 }
 
@@ -61,7 +143,450 @@ Server::~Server() {
     terminate();
 }
 
+// Marks the response with the connection persistence requested by the client
+// Returns true when the connection should be kept open
+static bool wants_keep_alive(http::request& req) {
+    auto connection = req.headers.find(http::field::connection);
+    return connection != req.headers.end() && http::iequals(connection->second, "keep-alive");
+}
+
+static bool apply_keep_alive(http::request& req, http::response& res) {
+    if (wants_keep_alive(req)) {
+        res.headers[http::field::connection] = "keep-alive";
+        return true;
+    }
+    res.headers[http::field::connection] = "close";
+    return false;
+}
+
+static http::content_coding accepted_coding(http::request& req, unsigned available = ~0u) {
+    auto it = req.headers.find(http::field::accept_encoding);
+    if (it == req.headers.end())
+        return http::content_coding::identity;
+    return http::negotiate_encoding(it->second, available);
+}
+
+// Weak comparison of an If-None-Match list against an entity tag, "*" matches any
+static bool etag_matches(std::string_view list, const std::string& etag) {
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view tag = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+
+        while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t'))
+            tag.remove_prefix(1);
+        while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t'))
+            tag.remove_suffix(1);
+        if (tag == "*")
+            return true;
+        if (tag.substr(0, 2) == "W/")
+            tag.remove_prefix(2);
+        if (tag == etag)
+            return true;
+    }
+    return false;
+}
+
+// Evaluates the conditional headers of a GET or HEAD, If-None-Match takes precedence over If-Modified-Since
+static bool not_modified(http::request& req, const static_asset& asset, const static_variant& variant) {
+    if (req.verb != http::verb::get && req.verb != http::verb::head)
+        return false;
+
+    auto match = req.headers.find(http::field::if_none_match);
+    if (match != req.headers.end())
+        return etag_matches(match->second, variant.etag);
+
+    auto since = req.headers.find(http::field::if_modified_since);
+    time_t date;
+    if (since != req.headers.end() && parse_http_date(since->second, date))
+        return asset.modified <= date;
+    return false;
+}
+
+// Parses a Range value against a representation of size bytes into inclusive byte ranges
+// Only the satisfiable ranges are kept, returns false when the value is malformed or not in bytes
+static bool parse_ranges(std::string_view value, size_t size, std::pmr::vector<std::pair<size_t, size_t>>& ranges) {
+    if (value.substr(0, 6) != "bytes=")
+        return false;
+    value.remove_prefix(6);
+
+    auto parse_number = [](std::string_view digits, size_t& number) {
+        if (digits.empty() || digits.size() > 19)
+            return false;
+        number = 0;
+        for (char c: digits) {
+            if (c < '0' || c > '9')
+                return false;
+            number = number * 10 + (c - '0');
+        }
+        return true;
+    };
+
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view spec = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+
+        while (!spec.empty() && (spec.front() == ' ' || spec.front() == '\t'))
+            spec.remove_prefix(1);
+        while (!spec.empty() && (spec.back() == ' ' || spec.back() == '\t'))
+            spec.remove_suffix(1);
+        if (spec.empty())
+            continue;
+
+        size_t dash = spec.find('-');
+        if (dash == std::string_view::npos)
+            return false;
+
+        size_t first, last;
+        if (dash == 0) {
+            // Suffix range, the last n bytes
+            size_t length;
+            if (!parse_number(spec.substr(1), length))
+                return false;
+            if (length == 0 || size == 0)
+                continue;
+            first = length >= size ? 0 : size - length;
+            last = size - 1;
+        } else {
+            if (!parse_number(spec.substr(0, dash), first))
+                return false;
+            if (dash + 1 == spec.size()) {
+                last = size - 1;
+            } else {
+                if (!parse_number(spec.substr(dash + 1), last) || last < first)
+                    return false;
+                last = std::min(last, size - 1);
+            }
+            if (first >= size)
+                continue;
+        }
+        ranges.emplace_back(first, last);
+    }
+    return true;
+}
+
+// If-Range only allows the ranges when the file is still the version the client has
+static bool if_range_matches(http::request& req, const static_asset& asset) {
+    auto condition = req.headers.find(http::field::if_range);
+    if (condition == req.headers.end())
+        return true;
+
+    std::string_view value = condition->second;
+    if (!value.empty() && (value[0] == '"' || value.substr(0, 2) == "W/"))
+        return value == asset.identity.etag; // strong comparison, a weak tag never matches
+    time_t date;
+    return parse_http_date(value, date) && date == asset.modified;
+}
+
+// Compresses a large text body the client can decode, the headers are updated to match
+static void compress_response(http::request& req, http::response& res, size_t min_size, int level) {
+    if (res.body.size() < min_size || res.headers.contains(http::field::content_encoding))
+        return;
+    auto type = res.headers.find(http::field::content_type);
+    if (type == res.headers.end() || !http::compressible(type->second))
+        return;
+
+    http::content_coding coding = accepted_coding(req);
+    res.headers[http::field::vary] = "Accept-Encoding";
+    if (coding == http::content_coding::identity)
+        return;
+
+    res.body = http::compress(res.body, coding, level);
+    res.headers[http::field::content_encoding] = http::coding_name(coding);
+    res.headers[http::field::content_length] = std::to_string(res.body.size());
+}
+
+// Connection events go to the log and to the metrics
+static void client_connected(std::string_view ip) {
+    Metrics::instance().connection_opened();
+    Logger::instance().log(log_level::debug, log_event::connected, ip);
+}
+
+static void client_disconnected(std::string_view ip) {
+    Metrics::instance().connection_closed();
+    Logger::instance().log(log_level::debug, log_event::disconnected, ip);
+}
+
+static void handshake_failed(std::string_view ip) {
+    Metrics::instance().tls_failure();
+    Logger::instance().log(log_level::warning, log_event::tls_failed, ip);
+}
+
+// Allow header value listing the verbs of the mask
+static std::string allowed_verbs(unsigned verbs) {
+    std::string allow;
+    for (int v = 1; v < http::VERB_COUNT; v++) {
+        if ((verbs & (1u << v)) == 0)
+            continue;
+        if (!allow.empty())
+            allow += ", ";
+        allow += http::verb_name((http::verb)v);
+    }
+    return allow;
+}
+
+// Serialized reply to a request the parser rejected, the connection is closed after it
+static std::string reject_response(http::parse_status status) {
+    http::response res = status == http::parse_status::too_large ? http::payload_too_large() : http::bad_request();
+    res.headers[http::field::connection] = "close";
+    res.headers[http::field::date] = CoarseClock::instance().date();
+    std::string data = http::serialize_response(res);
+
+    Metrics& metrics = Metrics::instance();
+    metrics.parse_error();
+    metrics.sent(data.size());
+    return data;
+}
+
+// Moves every complete request of the input buffer to batch, up to max
+// Stops after a request that closes the connection since nothing after it gets an answer
+// Returns the status of the request that ended the batch
+static http::parse_status take_requests(http::request_parser& parser, std::string& input,
+                                        std::pmr::vector<http::request>& batch, size_t max) {
+    http::parse_status status = http::parse_status::complete;
+    size_t consumed = 0;
+    while (batch.size() < max) {
+        status = parser.parse(std::string_view(input).substr(consumed));
+        if (status != http::parse_status::complete)
+            break;
+
+        const http::request_view& view = parser.request();
+        batch.push_back(view.to_request(batch.get_allocator()));
+        consumed += view.size;
+        parser.reset();
+
+        if (!wants_keep_alive(batch.back()))
+            break;
+    }
+
+    // One erase for the whole batch, the parser state of a partial request is relative to the new start
+    if (consumed > 0) {
+        Metrics::instance().received(consumed);
+        input.erase(0, consumed);
+        parser.reset();
+    }
+    return status;
+}
+
+Server::reply Server::build_response(http::request& req, bool& keep_alive) {
+    reply out;
+    if (static_response(req, out, keep_alive))
+        return out;
+
+    AdmissionControl::ticket ticket(admission.get());
+    if (!ticket) {
+        shed_request(req, out, keep_alive);
+        return out;
+    }
+    http::response res = process_request(req);
+    return controller_reply(req, res, keep_alive);
+}
+
+// Answers of the load shedding, serialized once, the Date is added to each copy
+static constexpr std::string_view OVERLOADED_KEEP_ALIVE = "HTTP/1.1 503 Service Unavailable\r\n"
+                                                          "Retry-After: 1\r\n"
+                                                          "Content-Length: 0\r\n"
+                                                          "Connection: keep-alive\r\n\r\n";
+static constexpr std::string_view OVERLOADED_CLOSE = "HTTP/1.1 503 Service Unavailable\r\n"
+                                                     "Retry-After: 1\r\n"
+                                                     "Content-Length: 0\r\n"
+                                                     "Connection: close\r\n\r\n";
+
+void Server::shed_request(http::request& req, reply& out, bool& keep_alive) {
+    keep_alive = wants_keep_alive(req);
+    out.head = keep_alive ? OVERLOADED_KEEP_ALIVE : OVERLOADED_CLOSE;
+    out.set_date(CoarseClock::instance().date());
+    out.status = 503;
+    Metrics::instance().request_shed();
+}
+
+void Server::shed_connection(int client_fd) {
+    Metrics::instance().connection_shed();
+    // A TLS client can't read a plain answer and the handshake is what shedding saves, it is just closed
+    if (!use_tls) {
+        reply out;
+        out.head = OVERLOADED_CLOSE;
+        out.set_date(CoarseClock::instance().date());
+        iovec iov[2] = {{(void*)out.head.data(), out.head.size() - 2}, {out.date_line, out.date_size}};
+        msghdr message{};
+        message.msg_iov = iov;
+        message.msg_iovlen = 2;
+        // Best effort, a fresh socket buffer always takes it and the accept loop never waits
+        sendmsg(client_fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+        // Closing over an unread request resets the connection, which may drop the 503 at the client
+        char discarded[1024];
+        for (int i = 0; i < 16 && recv(client_fd, discarded, sizeof(discarded), MSG_DONTWAIT) > 0; i++) {}
+    }
+    close(client_fd);
+}
+
+bool Server::static_response(http::request& req, reply& out, bool& keep_alive) {
+    if (!static_files.empty()) {
+        Arena::scope scratch;
+        std::pmr::string uri(Arena::current());
+        for (auto& r: req.uri.route) {
+            uri += '/';
+            uri += r;
+        }
+        if (uri.empty())
+            uri = "/";
+
+        // Static hits go out as the cached head and bytes, nothing is serialized or copied
+        out.asset = static_files.find(uri);
+        if (out.asset) {
+            keep_alive = wants_keep_alive(req);
+            // Only gzip is precompressed, a client preferring deflate still gets it when it accepts it
+            bool gzip = !out.asset->gzip_body.empty() &&
+                        accepted_coding(req, http::coding_bit(http::content_coding::gzip)) == http::content_coding::gzip;
+            const static_variant& variant = gzip ? out.asset->gzip : out.asset->identity;
+            if (not_modified(req, *out.asset, variant)) {
+                out.head = variant.not_modified(keep_alive);
+                out.set_date(CoarseClock::instance().date());
+                out.status = 304;
+                return true;
+            }
+
+            if (req.verb == http::verb::get && req.headers.contains(http::field::range) &&
+                range_response(req, out, keep_alive))
+                return true;
+
+            out.head = variant.head(keep_alive);
+            out.set_date(CoarseClock::instance().date());
+            out.status = 200;
+            if (req.verb != http::verb::head)
+                out.body = gzip ? out.asset->gzip_content() : out.asset->content();
+            return true;
+        }
+    }
+    return false;
+}
+
+Server::reply Server::controller_reply(http::request& req, http::response& res, bool& keep_alive) {
+    reply out;
+    keep_alive = apply_keep_alive(req, res);
+    if (compress_responses)
+        compress_response(req, res, compress_min_size, compress_level);
+    if (!res.headers.contains(http::field::date))
+        res.headers[http::field::date] = CoarseClock::instance().date();
+    // Head and body go out as two iovecs, the head keeps the Content-Length of the body for HEAD
+    http::serialize_head(res, out.data);
+    out.status = res.status_code;
+    if (req.verb != http::verb::head)
+        out.content = std::move(res.body);
+    return out;
+}
+
+// Labels of the requests that didn't reach a controller
+static constexpr std::string_view STATIC_ROUTE = "<static>";
+static constexpr std::string_view UNMATCHED_ROUTE = "<unmatched>";
+static constexpr std::string_view SHED_ROUTE = "<shed>";
+
+void Server::record_request(std::string_view ip, const http::request& req, const reply& out,
+                            std::chrono::steady_clock::time_point start) {
+    auto latency = std::chrono::steady_clock::now() - start;
+    Metrics& metrics = Metrics::instance();
+    std::string_view route = !req.route.empty() ? req.route
+                           : out.asset           ? STATIC_ROUTE
+                           : out.status == 503   ? SHED_ROUTE
+                                                 : UNMATCHED_ROUTE;
+    size_t bytes = out.size();
+    metrics.request(route, out.status, latency);
+    metrics.sent(bytes);
+
+    Logger& logger = Logger::instance();
+    if (!logger.enabled(log_level::info))
+        return;
+    // The path is rebuilt on the stack, the record truncates it anyway
+    char path[log_record::TEXT_SIZE];
+    size_t size = 0;
+    for (const std::pmr::string& segment: req.uri.route) {
+        if (size == sizeof(path))
+            break;
+        path[size++] = '/';
+        size_t length = std::min(segment.size(), sizeof(path) - size);
+        std::memcpy(path + size, segment.data(), length);
+        size += length;
+    }
+    if (size == 0)
+        path[size++] = '/';
+    logger.access(ip, req.method, std::string_view(path, size), out.status, bytes, latency);
+}
+
+std::pmr::vector<Server::reply> Server::build_responses(std::pmr::vector<http::request>& batch, bool& keep_alive,
+                                                        std::string_view ip) {
+    std::pmr::vector<reply> replies(Arena::current());
+    replies.reserve(batch.size());
+    keep_alive = true;
+    for (http::request& req: batch) {
+        auto start = std::chrono::steady_clock::now();
+        replies.push_back(build_response(req, keep_alive));
+        record_request(ip, req, replies.back(), start);
+        if (!keep_alive)
+            break;
+    }
+    return replies;
+}
+
+http::response Server::process_request(http::request& req) {
+    http::response res;
+    size_t ran = 0;
+    if (!middlewares || middlewares->before(req, res, ran)) {
+        Controller* controller = route_request(req, res);
+        if (controller != nullptr)
+            res = controller->dispatch(req);
+    }
+    if (middlewares)
+        middlewares->after(req, res, ran);
+    return res;
+}
+
+async::task<http::response> Server::process_request_async(http::request& req) {
+    http::response res;
+    size_t ran = 0;
+    if (!middlewares || middlewares->before(req, res, ran)) {
+        Controller* controller = route_request(req, res);
+        if (controller != nullptr && controller->is_async()) {
+            res = co_await static_cast<AsyncController*>(controller)->dispatch_async(req);
+        } else if (controller != nullptr) {
+            // The slow synchronous controllers still go to the workers when there are some
+            if (workers)
+                res = co_await async::offload(*workers, [controller, &req]() { return controller->dispatch(req); });
+            else
+                res = controller->dispatch(req);
+        }
+    }
+    if (middlewares)
+        middlewares->after(req, res, ran);
+    co_return res;
+}
+
+Controller* Server::route_request(http::request& req, http::response& res) {
+    if (req.verb == http::verb::unknown) {
+        res = http::not_implemented();
+        return nullptr;
+    }
+
+    unsigned verbs = 0;
+    Controller* controller = router.match(req.uri.route, req.path_params, verbs);
+    if (controller == nullptr) {
+        res = http::not_found();
+        return nullptr;
+    }
+    req.route = controller->get_route();
+    // Methods the controller doesn't override are answered here without calling it
+    if ((verbs & (1u << (int)req.verb)) == 0) {
+        res = http::method_not_allowed();
+        res.headers[http::field::allow] = allowed_verbs(verbs);
+        return nullptr;
+    }
+    return controller;
+}
+
 void Server::start_server_loop() {
+    // Each connection still blocks a thread of its own, but the threads are started once: max_connections
+    // bounds the connections, so an accepted one always finds an idle thread and accept never creates one
+    ThreadPool connection_threads(max_connections);
     int new_socket;
     socklen_t al = sizeof(address);
     //int con_index;
@@ -73,95 +598,80 @@ void Server::start_server_loop() {
                 break;
             }
         }*/
-        if (connections.size() >= max_connections) {
-            // throw runtime_error("Too many connections");
-            usleep(100000); // Sleep for 0.1 second
-            continue;
-        }
         std::unique_ptr<sockaddr_in> address = std::make_unique<sockaddr_in>();
         if ((new_socket = accept(fd, (struct sockaddr*)address.get(), &al)) < 0) {
             continue;
         }
-        std::lock_guard<std::mutex> lock(connections_mutex);
+        // Over the limit the client gets a 503 right away instead of waiting in the backlog
+        // The lock only covers the decision, the clients closing their connections don't wait on the 503
+        std::unique_lock<std::mutex> lock(connections_mutex);
+        if (connections.size() >= (size_t)max_connections) {
+            lock.unlock();
+            shed_connection(new_socket);
+            continue;
+        }
         connections.push_back({new_socket, nullptr});
         std::list<connection>::iterator it = std::prev(connections.end());
         if (use_tls) {
             SSL* ssl;
             if (establish_connection(&ssl, ssl_ctx, new_socket)) {
                 it->ssl = ssl;
-                std::thread(&Server::handle_tls_client, this, ssl, new_socket, std::move(address), it).detach();
+                connection_threads.submit([this, ssl, new_socket, peer = *address, it]() {
+                    handle_tls_client(ssl, new_socket, std::make_unique<sockaddr_in>(peer), it);
+                });
             } else {
-                std::cout << "Failed to establish tls connection with client: " <<
-                    (unsigned char)(address->sin_addr.s_addr) << std::endl;
+                handshake_failed(ip_to_str(address->sin_addr.s_addr));
                 connections.erase(it);
             }
-        } else
-            std::thread(&Server::handle_client, this, new_socket, std::move(address), it).detach();
+        } else {
+            connection_threads.submit([this, new_socket, peer = *address, it]() {
+                handle_client(new_socket, std::make_unique<sockaddr_in>(peer), it);
+            });
+        }
     }
+    // The pool waits for the connections, terminate woke them up
 }
 
 void Server::handle_client(int socket_fd, std::unique_ptr<sockaddr_in> address, std::list<connection>::iterator it) {
-    std::unique_ptr<http::response> res = std::make_unique<http::response>();
     bool keep_alive = false;
 
     std::string ip = ip_to_str(address->sin_addr.s_addr);
 
-    std::cout << '[' << get_time()
-              << "] Client connected: "
-              << ip
-              << std::endl;
+    client_connected(ip);
+
+    std::string input;
+    http::request_parser parser;
 
     try {
     keep:
-        res.reset(new http::response(http::not_found()));
-        std::string input = read_to_end(socket_fd);
-        http::request req = http::parse_request(input);
-
-        std::cout << '[' << get_time()
-                  << "] Client: "
-                  << ip
-                  << " sent "
-                  << req.method
-                  << " request"
-                  << std::endl;
-
-        std::string uri = "";
-        for (auto& r: req.uri.route)
-            uri += "/" + r ;
-
-        if (uri.empty())
-            uri = "/";
-
-        if (static_files.find(uri) != static_files.end()) {
-            res.reset(new http::response(http::ok(get_content_type(uri), static_files[uri].data())));
-        } else if (uri == "/" && static_files.find("/index.html") != static_files.end()) {
-            res.reset(new http::response(http::ok("text/html", static_files["/index.html"].data())));
-        } else if (!req.uri.route.empty()) {
-            for (auto& c: controllers) {
-                if (c->get_route() == req.uri.route[0]) {
-                    res.reset(new http::response(c->handle(req)));
-                }
-            }
+        // The batch, the replies and their pieces live until the write, then the arena is reset
+        Arena::scope scratch;
+        std::pmr::vector<http::request> batch(Arena::current());
+        http::parse_status status;
+        while ((status = take_requests(parser, input, batch, MAX_PIPELINE_DEPTH)) == http::parse_status::need_more &&
+               batch.empty()) {
+            if (read_some(socket_fd, input) == 0)
+                throw std::runtime_error("Connection closed by the client");
         }
 
-        if (req.headers.find("Connection") != req.headers.end() &&
-            req.headers["Connection"] == "keep-alive") {
-            keep_alive = true;
-            res->headers["Connection"] = "keep-alive";
-        } else {
-        	keep_alive = false;
-        	res->headers["Connection"] = "close";
+        // Every pipelined request already received is answered with a single write
+        std::pmr::vector<reply> replies = build_responses(batch, keep_alive, ip);
+        bool rejected = keep_alive && status != http::parse_status::complete && status != http::parse_status::need_more;
+        if (rejected) {
+            replies.emplace_back();
+            replies.back().data = reject_response(status);
         }
 
-        std::string res_str = http::serialize_response(*res);
-        write(socket_fd, res_str.data(), res_str.size());
+        std::pmr::vector<iovec> iov(Arena::current());
+        for (const reply& r: replies)
+            r.gather(iov);
+        write_all(socket_fd, iov);
 
+        if (rejected)
+            throw std::runtime_error("Rejected request");
         if (keep_alive) goto keep;
     } catch (...) {
-        std::cout << '[' << get_time()
-              << "] Error with client: "
-              << ip
-              << std::endl;
+        Logger::instance().log(log_level::warning, log_event::client_error, ip);
     }
 
     close(socket_fd);
@@ -169,74 +679,49 @@ void Server::handle_client(int socket_fd, std::unique_ptr<sockaddr_in> address,
     std::lock_guard<std::mutex> lock(connections_mutex);
     connections.erase(it);
 
-    std::cout << '[' << get_time()
-              << "] Client disconnected: "
-              << ip
-              << std::endl;
+    client_disconnected(ip);
 }
 
 void Server::handle_tls_client(SSL* ssl, int socket_fd, std::unique_ptr<sockaddr_in> address, std::list<connection>::iterator it) {
-    std::unique_ptr<http::response> res = std::make_unique<http::response>(http::not_found());
     bool keep_alive = false;
 
     std::string ip = ip_to_str(address->sin_addr.s_addr);
 
-    std::cout << '[' << get_time()
-              << "] Client connected: "
-              << ip
-              << std::endl;
+    client_connected(ip);
+
+    std::string input;
+    http::request_parser parser;
 
     try {
     keep:
-        res.reset(new http::response(http::not_found()));
-        std::string input = read_to_end(ssl, socket_fd);
-        http::request req = http::parse_request(input);
-
-        std::cout << '[' << get_time()
-                  << "] Client: "
-                  << ip
-                  << " sent "
-                  << req.method
-                  << " request"
-                  << std::endl;
-
-        std::string uri = "";
-        for (auto& r: req.uri.route)
-            uri += "/" + r ;
-
-        if (uri.empty())
-            uri = "/";
-
-        if (static_files.find(uri) != static_files.end()) {
-            res.reset(new http::response(http::ok(get_content_type(uri), static_files[uri].data())));
-        } else if (uri == "/" && static_files.find("/index.html") != static_files.end()) {
-            res.reset(new http::response(http::ok("text/html", static_files["/index.html"].data())));
-        } else if (!req.uri.route.empty()) {
-            for (auto& c: controllers) {
-                if (c->get_route() == req.uri.route[0]) {
-                    res.reset(new http::response(c->handle(req)));
-                }
-            }
+        // The batch, the replies and their pieces live until the write, then the arena is reset
+        Arena::scope scratch;
+        std::pmr::vector<http::request> batch(Arena::current());
+        http::parse_status status;
+        while ((status = take_requests(parser, input, batch, MAX_PIPELINE_DEPTH)) == http::parse_status::need_more &&
+               batch.empty()) {
+            if (read_some(ssl, socket_fd, input) == 0)
+                throw std::runtime_error("Connection closed by the client");
         }
 
-        if (req.headers.find("Connection") != req.headers.end() &&
-            req.headers["Connection"] == "keep-alive") {
-            keep_alive = true;
-            res->headers["Connection"] = "keep-alive";
-        } else {
-            keep_alive = false;
-            res->headers["Connection"] = "close";
+        // Every pipelined request already received is answered with a single write
+        std::pmr::vector<reply> replies = build_responses(batch, keep_alive, ip);
+        bool rejected = keep_alive && status != http::parse_status::complete && status != http::parse_status::need_more;
+        if (rejected) {
+            replies.emplace_back();
+            replies.back().data = reject_response(status);
         }
 
-        std::string res_str = http::serialize_response(*res);
-        SSL_write(ssl, res_str.data(), res_str.size());
+        std::pmr::vector<iovec> iov(Arena::current());
+        for (const reply& r: replies)
+            r.gather(iov);
+        write_all(ssl, iov);
 
+        if (rejected)
+            throw std::runtime_error("Rejected request");
         if (keep_alive) goto keep;
     } catch (...) {
-        std::cout << '[' << get_time()
-              << "] Error with client: "
-              << ip
-              << std::endl;
+        Logger::instance().log(log_level::warning, log_event::client_error, ip);
     }
 
     close(socket_fd);
@@ -245,22 +730,869 @@ void Server::handle_tls_client(SSL* ssl, int socket_fd, std::unique_ptr<sockaddr
     std::lock_guard<std::mutex> lock(connections_mutex);
     connections.erase(it);
 
-    std::cout << '[' << get_time()
-              << "] Client disconnected: "
-              << ip
-              << std::endl;
+    client_disconnected(ip);
+}
+
+void Server::start_event_loops() {
+    int count = io_threads > 0 ? io_threads : (int)std::thread::hardware_concurrency();
+    if (count <= 0)
+        count = 1;
+    int cores = std::max(1, (int)std::thread::hardware_concurrency());
+
+    loops.clear();
+    for (int i = 0; i < count; i++) {
+        std::unique_ptr<event_loop> loop = std::make_unique<event_loop>();
+
+        // A shard gets its own listener in the SO_REUSEPORT group so the kernel spreads the accepts,
+        // otherwise every loop waits on the same socket and EPOLLEXCLUSIVE wakes only one of them
+        uint32_t listen_events = EPOLLIN | EPOLLEXCLUSIVE;
+        loop->listen_fd = fd;
+        if (mode == io_mode::sharded) {
+            listen_events = EPOLLIN;
+            if (i > 0) {
+                loop->listen_fd = create_listener(address);
+                if (listen(loop->listen_fd, max_connections)) {
+                    close(loop->listen_fd);
+                    throw std::runtime_error("Can not listen for incoming connections");
+                }
+            }
+        }
+
+        loop->wake_fd = eventfd(0, EFD_CLOEXEC);
+        if (loop->wake_fd == -1)
+            throw std::runtime_error("Failed to create event loop");
+
+        // io_uring fails accepts on a non-blocking listener with EAGAIN instead of waiting
+        if (mode == io_mode::io_uring) {
+            loop->ring = std::make_unique<IoUring>(RING_ENTRIES);
+            loop->ring->setup_buffers(RING_BUFFER_GROUP, RING_BUFFERS, BUFFER_SIZE);
+            loops.push_back(std::move(loop));
+            continue;
+        }
+
+        int flags = fcntl(loop->listen_fd, F_GETFL, 0);
+        if (flags == -1 || fcntl(loop->listen_fd, F_SETFL, flags | O_NONBLOCK) == -1)
+            throw std::runtime_error("Failed to make the server socket non-blocking");
+        flags = fcntl(loop->wake_fd, F_GETFL, 0);
+        fcntl(loop->wake_fd, F_SETFL, flags | O_NONBLOCK);
+
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epoll_fd == -1)
+            throw std::runtime_error("Failed to create event loop");
+
+        epoll_event ev{};
+        ev.events = listen_events;
+        ev.data.u64 = LISTEN_EVENT;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &ev) == -1)
+            throw std::runtime_error("Failed to register the server socket");
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = WAKE_EVENT;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) == -1)
+            throw std::runtime_error("Failed to register the wake up event");
+
+        loops.push_back(std::move(loop));
+    }
+
+    for (int i = 0; i < count; i++) {
+        event_loop& loop = *loops[i];
+        if (mode == io_mode::io_uring)
+            loop.thread = std::thread(&Server::run_ring_loop, this, std::ref(loop));
+        else
+            loop.thread = std::thread(&Server::run_event_loop, this, std::ref(loop));
+        if (mode == io_mode::sharded) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % cores, &cpus);
+            pthread_setaffinity_np(loop.thread.native_handle(), sizeof(cpus), &cpus);
+        }
+    }
+
+    for (auto& loop: loops)
+        loop->thread.join();
+
+    // Workers and coroutines may still report to the loops, their wake up fds must outlive them
+    if (workers)
+        workers->wait_idle();
+    while (async_pending.load() > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    for (auto& loop: loops) {
+        if (loop->listen_fd != fd)
+            close(loop->listen_fd);
+        if (loop->epoll_fd != -1)
+            close(loop->epoll_fd);
+        loop->ring.reset();
+        close(loop->wake_fd);
+        loop->epoll_fd = -1;
+        loop->wake_fd = -1;
+    }
+}
+
+void Server::run_event_loop(event_loop& loop) {
+    constexpr int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+    time_t last_sweep = time(nullptr);
+
+    while (running) {
+        int count = epoll_wait(loop.epoll_fd, events, MAX_EVENTS, 1000);
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == WAKE_EVENT) {
+                uint64_t value;
+                read(loop.wake_fd, &value, sizeof(value));
+                drain_completions(loop);
+            } else if (tag == LISTEN_EVENT) {
+                accept_clients(loop);
+            } else {
+                auto it = loop.clients.find(tag);
+                if (it != loop.clients.end())
+                    handle_event(loop, *it->second, events[i].events);
+            }
+        }
+
+        // Drop the connections that stayed idle for too long
+        time_t now = time(nullptr);
+        if (now != last_sweep) {
+            last_sweep = now;
+            std::vector<client_state*> expired;
+            for (auto& c: loop.clients) {
+                if (c.second->state != client_state::phase::processing &&
+                    now - c.second->last_active > CLIENT_TIMEOUT_S)
+                    expired.push_back(c.second.get());
+            }
+            for (client_state* c: expired)
+                close_client(loop, *c);
+        }
+    }
+
+    while (!loop.clients.empty())
+        close_client(loop, *loop.clients.begin()->second);
+}
+
+void Server::accept_clients(event_loop& loop) {
+    while (running) {
+        sockaddr_in client_address;
+        socklen_t al = sizeof(client_address);
+        int client_fd = accept4(loop.listen_fd, (struct sockaddr*)&client_address, &al, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return; // EAGAIN means the backlog is drained, anything else is retried on the next wake up
+        }
+
+        if (active_connections.load() >= max_connections) {
+            shed_connection(client_fd);
+            continue;
+        }
+
+        std::unique_ptr<client_state> client = std::make_unique<client_state>();
+        client->fd = client_fd;
+        client->id = next_client_id++;
+        client->ip = ip_to_str(client_address.sin_addr.s_addr);
+        client->last_active = time(nullptr);
+        if (use_tls) {
+            client->ssl = SSL_new(ssl_ctx);
+            SSL_set_fd(client->ssl, client_fd);
+            SSL_set_accept_state(client->ssl);
+            client->state = client_state::phase::handshake;
+        }
+
+        // Both directions are edge-triggered, the state machine decides what to do with each wake up
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = client->id;
+        if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+            if (client->ssl != nullptr)
+                SSL_free(client->ssl);
+            close(client_fd);
+            continue;
+        }
+
+        active_connections++;
+        client_connected(client->ip);
+        loop.clients[client->id] = std::move(client);
+    }
+}
+
+void Server::handle_event(event_loop& loop, client_state& client, uint32_t events) {
+    if (events & EPOLLERR) {
+        close_client(loop, client);
+        return;
+    }
+    client.last_active = time(nullptr);
+
+    if (client.state == client_state::phase::handshake) {
+        int result = SSL_accept(client.ssl);
+        if (result <= 0) {
+            int error = SSL_get_error(client.ssl, result);
+            if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+                return;
+            handshake_failed(client.ip);
+            close_client(loop, client);
+            return;
+        }
+        client.state = client_state::phase::reading;
+    }
+
+    drive_client(loop, client);
+}
+
+bool Server::serve_request(event_loop& loop, client_state& client) {
+    // A batch handed to the workers or a coroutine outlives this call, it is built in an arena of its own
+    // that goes along with it, the thread's arena is reset as soon as the scope ends
+    bool dispatched = workers || async_controllers;
+    std::unique_ptr<Arena> arena;
+    std::optional<Arena::scope> scratch;
+    if (dispatched) {
+        arena = take_arena(loop);
+        scratch.emplace(*arena);
+    } else {
+        scratch.emplace();
+    }
+    std::pmr::vector<http::request> batch(Arena::current());
+    http::parse_status status = take_requests(client.parser, client.input, batch, MAX_PIPELINE_DEPTH);
+    if (batch.empty() && arena)
+        loop.arenas.push_back(std::move(arena)); // Nothing was built in it
+    if (batch.empty() && status == http::parse_status::need_more)
+        return false;
+
+    // A request rejected behind a batch is answered on the next round, once the batch is written
+    if (batch.empty()) {
+        Logger::instance().log(log_level::warning,
+                               status == http::parse_status::too_large ? log_event::too_large : log_event::malformed,
+                               client.ip);
+
+        std::pmr::vector<reply> output(1);
+        output[0].data = reject_response(status);
+        client.keep_alive = false;
+        client.input.clear();
+        client.parser.reset();
+        set_output(client, std::move(output));
+        return true;
+    }
+
+    if (dispatched) {
+        dispatch_requests(loop, client, std::move(arena), batch);
+        return true;
+    }
+
+    // The responses go out back to back in one gathered send, moved out of the arena by set_output
+    std::pmr::vector<reply> output = build_responses(batch, client.keep_alive, client.ip);
+    client.keep_alive = client.keep_alive && !client.peer_closed;
+    set_output(client, std::move(output));
+    return true;
+}
+
+bool Server::range_response(http::request& req, reply& out, bool keep_alive) {
+    const static_asset& asset = *out.asset;
+    if (!if_range_matches(req, asset))
+        return false;
+
+    std::pmr::vector<std::pair<size_t, size_t>> ranges(Arena::current());
+    if (!parse_ranges(req.headers[http::field::range], asset.size, ranges) || ranges.size() > MAX_RANGES)
+        return false;
+
+    const char* connection = keep_alive ? "keep-alive" : "close";
+    std::string size = std::to_string(asset.size);
+    std::string_view date = CoarseClock::instance().date();
+
+    if (ranges.empty()) {
+        out.data = "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                   "Content-Range: bytes */" + size + "\r\n"
+                   "Content-Length: 0\r\n"
+                   "Date: " + std::string(date) + "\r\n"
+                   "Connection: " + connection + "\r\n\r\n";
+        out.status = 416;
+        return true;
+    }
+
+    // Only the slices are sent, they are borrowed from the cached or mapped bytes
+    std::string_view content = asset.content();
+    std::string head = "HTTP/1.1 206 Partial Content\r\n";
+    if (ranges.size() == 1) {
+        size_t first = ranges[0].first;
+        size_t last = ranges[0].second;
+        out.body = content.substr(first, last - first + 1);
+        head += "Content-Type: " + asset.content_type + "\r\n";
+        head += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + size + "\r\n";
+        head += "Content-Length: " + std::to_string(out.body.size()) + "\r\n";
+    } else {
+        static std::atomic<uint64_t> boundaries{0};
+        char boundary[32];
+        std::snprintf(boundary, sizeof(boundary), "%016llx", (unsigned long long)(++boundaries * 0x9e3779b97f4a7c15ULL));
+
+        size_t length = 0;
+        for (auto& range: ranges) {
+            std::string part_head = "\r\n--";
+            part_head += boundary;
+            part_head += "\r\nContent-Type: " + asset.content_type + "\r\n";
+            part_head += "Content-Range: bytes " + std::to_string(range.first) + "-" + std::to_string(range.second) + "/" + size + "\r\n\r\n";
+            std::string_view slice = content.substr(range.first, range.second - range.first + 1);
+            length += part_head.size() + slice.size();
+            out.parts.emplace_back(std::move(part_head), slice);
+        }
+        std::string closing = "\r\n--";
+        closing += boundary;
+        closing += "--\r\n";
+        length += closing.size();
+        out.parts.emplace_back(std::move(closing), std::string_view());
+
+        head += "Content-Type: multipart/byteranges; boundary=";
+        head += boundary;
+        head += "\r\nContent-Length: " + std::to_string(length) + "\r\n";
+    }
+    head += "ETag: " + asset.identity.etag + "\r\n";
+    head += "Last-Modified: " + asset.last_modified + "\r\n";
+    head += "Date: ";
+    head += date;
+    head += "\r\nConnection: ";
+    head += connection;
+    head += "\r\n\r\n";
+    out.data = std::move(head);
+    out.status = 206;
+    return true;
+}
+
+void Server::set_output(client_state& client, std::pmr::vector<reply> output) {
+    // client.output is on the heap, a batch built in the arena is moved element by element
+    client.output = std::move(output);
+    client.output_iov.clear();
+    for (const reply& r: client.output)
+        r.gather(client.output_iov);
+    client.output_index = 0;
+    client.state = client_state::phase::writing;
+}
+
+void Server::drive_client(event_loop& loop, client_state& client) {
+    while (true) {
+        if (client.state == client_state::phase::processing) {
+            // Keep draining the socket, the bytes wait in the input buffer for the next request
+            // Past MAX_BUFFERED_INPUT they are left in the socket, the reading phase goes on with them
+            if (!read_client(client, MAX_BUFFERED_INPUT))
+                client.peer_closed = true;
+            return;
+        }
+
+        if (client.state == client_state::phase::reading) {
+            if (!read_client(client, MAX_BUFFERED_INPUT))
+                client.peer_closed = true;
+
+            bool started;
+            try {
+                started = serve_request(loop, client);
+            } catch (...) {
+                Logger::instance().log(log_level::warning, log_event::client_error, client.ip);
+                close_client(loop, client);
+                return;
+            }
+            if (!started) {
+                // A full buffer without a complete request is more than the parser accepts
+                if (client.input.size() >= MAX_BUFFERED_INPUT)
+                    Logger::instance().log(log_level::warning, log_event::too_large, client.ip);
+                if (client.peer_closed || client.input.size() >= MAX_BUFFERED_INPUT)
+                    close_client(loop, client);
+                return;
+            }
+            if (client.state == client_state::phase::processing)
+                return;
+        }
+
+        if (!write_client(client)) {
+            close_client(loop, client);
+            return;
+        }
+        if (client.output_index < client.output_iov.size())
+            return; // The socket buffer is full, EPOLLOUT resumes the write
+
+        client.output.clear();
+        client.output_iov.clear();
+        if (!client.keep_alive) {
+            close_client(loop, client);
+            return;
+        }
+        client.state = client_state::phase::reading;
+    }
+}
+
+std::unique_ptr<Arena> Server::take_arena(event_loop& loop) {
+    if (loop.arenas.empty())
+        return std::make_unique<Arena>();
+    // A spare arena comes back once its batch is gone, nothing allocated from it is alive anymore
+    std::unique_ptr<Arena> arena = std::move(loop.arenas.back());
+    loop.arenas.pop_back();
+    arena->reset();
+    return arena;
+}
+
+void Server::dispatch_requests(event_loop& loop, client_state& client, std::unique_ptr<Arena> arena,
+                               std::pmr::vector<http::request>& batch) {
+    client.state = client_state::phase::processing;
+    // The replies are built in the batch arena too, the current one here
+    completion done{client.id, std::move(arena), std::move(batch), std::pmr::vector<reply>(Arena::current())};
+
+    if (async_controllers) {
+        async_pending++;
+        serve_async(&loop, client.ip, std::move(done));
+        return;
+    }
+
+    // The whole batch is one task so the responses stay in request order
+    // Shared since a task is copyable, only the worker running it touches the batch and its arena until it is posted
+    event_loop* target = &loop;
+    auto pending = std::make_shared<completion>(std::move(done));
+    workers->submit([this, target, ip = client.ip, pending]() {
+        completion& done = *pending;
+        {
+            Arena::scope scratch(*done.arena);
+            try {
+                done.output = build_responses(done.batch, done.keep_alive, ip);
+            } catch (...) {
+                done.failed = true;
+            }
+        }
+        post_completion(*target, std::move(done));
+    });
+}
+
+// The requests and replies stay in the batch arena, like what runs before the first suspension inside the scope
+// of serve_request, but a scope can't span a co_await: what the handlers build once resumed goes to the heap
+async::detached Server::serve_async(event_loop* loop, std::string ip, completion done) {
+    try {
+        done.keep_alive = true;
+        done.output.reserve(done.batch.size());
+        for (http::request& req: done.batch) {
+            auto start = std::chrono::steady_clock::now();
+            reply out;
+            if (!static_response(req, out, done.keep_alive)) {
+                AdmissionControl::ticket ticket(admission.get());
+                if (ticket) {
+                    http::response res = co_await process_request_async(req);
+                    out = controller_reply(req, res, done.keep_alive);
+                } else {
+                    shed_request(req, out, done.keep_alive);
+                }
+            }
+            record_request(ip, req, out, start);
+            done.output.push_back(std::move(out));
+            if (!done.keep_alive)
+                break;
+        }
+    } catch (...) {
+        done.failed = true;
+    }
+    post_completion(*loop, std::move(done));
+    async_pending--;
+}
+
+void Server::post_completion(event_loop& loop, completion done) {
+    {
+        std::lock_guard<std::mutex> lock(loop.completed_mutex);
+        loop.completed.push_back(std::move(done));
+    }
+    uint64_t value = 1;
+    write(loop.wake_fd, &value, sizeof(value));
+}
+
+void Server::drain_completions(event_loop& loop) {
+    std::vector<completion> done;
+    {
+        std::lock_guard<std::mutex> lock(loop.completed_mutex);
+        done.swap(loop.completed);
+    }
+
+    for (completion& c: done) {
+        auto it = loop.clients.find(c.id);
+        if (it == loop.clients.end() || it->second->id != c.id)
+            continue; // The client left while its request was running
+
+        client_state& client = *it->second;
+        if (client.state == client_state::phase::closing)
+            continue; // Dropped while its request was running, the close is on its way
+        if (c.failed) {
+            Logger::instance().log(log_level::warning, log_event::client_error, client.ip);
+            if (loop.ring)
+                ring_close(loop, client);
+            else
+                close_client(loop, client);
+            continue;
+        }
+
+        client.keep_alive = c.keep_alive && !client.peer_closed;
+        set_output(client, std::move(c.output));
+        if (loop.ring)
+            ring_send(loop, client);
+        else
+            drive_client(loop, client);
+    }
+
+    // The replies are copied out, the arenas are kept for the next batches once theirs are gone
+    std::vector<std::unique_ptr<Arena>> arenas;
+    for (completion& c: done) {
+        if (c.arena && loop.arenas.size() + arenas.size() < MAX_SPARE_ARENAS)
+            arenas.push_back(std::move(c.arena));
+    }
+    done.clear();
+    for (auto& arena: arenas)
+        loop.arenas.push_back(std::move(arena));
+}
+
+bool Server::read_client(client_state& client, size_t limit) {
+    char buffer[BUFFER_SIZE];
+    while (client.input.size() < limit) {
+        int bytes_read;
+        if (client.ssl != nullptr) {
+            bytes_read = SSL_read(client.ssl, buffer, BUFFER_SIZE);
+            if (bytes_read <= 0) {
+                int error = SSL_get_error(client.ssl, bytes_read);
+                return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE;
+            }
+        } else {
+            bytes_read = read(client.fd, buffer, BUFFER_SIZE);
+            if (bytes_read == 0)
+                return false;
+            if (bytes_read < 0) {
+                if (errno == EINTR)
+                    continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+        }
+        client.input.append(buffer, bytes_read);
+    }
+    return true;
+}
+
+bool Server::write_client(client_state& client) {
+    std::pmr::vector<iovec>& iov = client.output_iov;
+    while (client.output_index < iov.size()) {
+        ssize_t bytes_written;
+        if (client.ssl != nullptr) {
+            // A retried SSL_write must repeat the same buffer, so one piece at a time
+            iovec& piece = iov[client.output_index];
+            bytes_written = SSL_write(client.ssl, piece.iov_base, (int)piece.iov_len);
+            if (bytes_written <= 0) {
+                int error = SSL_get_error(client.ssl, (int)bytes_written);
+                return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE;
+            }
+        } else {
+            msghdr msg{};
+            msg.msg_iov = &iov[client.output_index];
+            msg.msg_iovlen = std::min(iov.size() - client.output_index, (size_t)IOV_MAX);
+            bytes_written = sendmsg(client.fd, &msg, MSG_NOSIGNAL);
+            if (bytes_written < 0) {
+                if (errno == EINTR)
+                    continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+        }
+
+        output_sent(client, (size_t)bytes_written);
+    }
+    return true;
+}
+
+void Server::output_sent(client_state& client, size_t sent) {
+    while (sent > 0) {
+        iovec& piece = client.output_iov[client.output_index];
+        if (sent >= piece.iov_len) {
+            sent -= piece.iov_len;
+            client.output_index++;
+        } else {
+            piece.iov_base = (char*)piece.iov_base + sent;
+            piece.iov_len -= sent;
+            sent = 0;
+        }
+    }
+}
+
+void Server::close_client(event_loop& loop, client_state& client) {
+    int client_fd = client.fd;
+    uint64_t id = client.id;
+    std::string ip = client.ip;
+
+    epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, client_fd, nullptr);
+    if (client.ssl != nullptr) {
+        SSL_shutdown(client.ssl);
+        SSL_free(client.ssl);
+    }
+    close(client_fd);
+    loop.clients.erase(id);
+    active_connections--;
+
+    client_disconnected(ip);
+}
+
+void Server::run_ring_loop(event_loop& loop) {
+    IoUring& ring = *loop.ring;
+    arm_accept(ring, loop.listen_fd);
+    arm_wake(ring, loop.wake_fd, &loop.wake_value);
+    arm_timer(ring);
+
+    while (running) {
+        try {
+            ring.submit(1);
+        } catch (const std::exception& e) {
+            Logger::instance().message(log_level::error, e.what());
+            break;
+        }
+        ring.for_each_cqe([&](const io_uring_cqe& cqe) {
+            handle_ring_completion(loop, cqe);
+        });
+    }
+
+    // Closing the ring cancels the pending requests, the sockets can then be closed directly
+    for (auto& c: loop.clients) {
+        close(c.second->fd);
+        active_connections--;
+    }
+    loop.clients.clear();
+}
+
+void Server::handle_ring_completion(event_loop& loop, const io_uring_cqe& cqe) {
+    IoUring& ring = *loop.ring;
+    uint64_t id = cqe.user_data >> 8;
+    ring_op op = (ring_op)(cqe.user_data & 0xff);
+
+    if (op == RING_ACCEPT) {
+        if (cqe.res >= 0)
+            ring_accept(loop, cqe.res);
+        if (!(cqe.flags & IORING_CQE_F_MORE) && running)
+            arm_accept(ring, loop.listen_fd);
+        return;
+    }
+
+    if (op == RING_WAKE) {
+        drain_completions(loop);
+        arm_wake(ring, loop.wake_fd, &loop.wake_value);
+        return;
+    }
+
+    if (op == RING_TIMER) {
+        // Drop the connections that stayed idle for too long
+        time_t now = time(nullptr);
+        std::vector<client_state*> expired;
+        for (auto& c: loop.clients) {
+            if (c.second->state == client_state::phase::reading &&
+                now - c.second->last_active > CLIENT_TIMEOUT_S)
+                expired.push_back(c.second.get());
+        }
+        for (client_state* c: expired)
+            ring_close(loop, *c);
+        arm_timer(ring);
+        return;
+    }
+
+    auto it = loop.clients.find(id);
+    if (it == loop.clients.end()) {
+        if (op == RING_RECV && (cqe.flags & IORING_CQE_F_BUFFER))
+            ring.recycle_buffer((uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+        return;
+    }
+    client_state& client = *it->second;
+
+    switch (op) {
+    case RING_RECV: {
+        if (cqe.res > 0) {
+            uint16_t buffer_id = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (client.state != client_state::phase::closing) {
+                client.input.append(ring.buffer(buffer_id), cqe.res);
+                client.last_active = time(nullptr);
+            }
+            ring.recycle_buffer(buffer_id);
+            // The multishot receive can't be paused while the batch is processed or sent, the client is dropped instead
+            if (client.state != client_state::phase::reading && client.state != client_state::phase::closing &&
+                client.input.size() > MAX_BUFFERED_INPUT) {
+                Logger::instance().log(log_level::warning, log_event::too_large, client.ip);
+                ring_close(loop, client);
+                return;
+            }
+        } else if (cqe.res != -ENOBUFS) {
+            client.peer_closed = true;
+        }
+
+        if (client.state == client_state::phase::closing)
+            return;
+
+        // A multishot receive ends when it runs out of buffers, it is armed again unless the peer left
+        if (!(cqe.flags & IORING_CQE_F_MORE) && !client.peer_closed)
+            arm_recv(ring, client.fd, client.id);
+        ring_process(loop, client);
+        break;
+    }
+    case RING_SEND: {
+        if (client.state == client_state::phase::closing)
+            return; // The linked shutdown and close finish the connection
+        if (cqe.res <= 0) {
+            ring_close(loop, client);
+            return;
+        }
+        // A batch of more than IOV_MAX pieces, or a short send, goes on from where it stopped
+        output_sent(client, (size_t)cqe.res);
+        if (client.output_index < client.output_iov.size()) {
+            ring_send(loop, client);
+            return;
+        }
+        client.output.clear();
+        client.output_iov.clear();
+        client.state = client_state::phase::reading;
+        ring_process(loop, client);
+        break;
+    }
+    case RING_CLOSE: {
+        // A failed send breaks the link and the close never ran
+        if (cqe.res == -ECANCELED)
+            close(client.fd);
+        client_disconnected(client.ip);
+        loop.clients.erase(it);
+        active_connections--;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void Server::ring_accept(event_loop& loop, int client_fd) {
+    if (active_connections.load() >= max_connections) {
+        shed_connection(client_fd);
+        return;
+    }
+
+    sockaddr_in client_address{};
+    socklen_t al = sizeof(client_address);
+    getpeername(client_fd, (struct sockaddr*)&client_address, &al);
+
+    std::unique_ptr<client_state> client = std::make_unique<client_state>();
+    client->fd = client_fd;
+    client->id = next_client_id++;
+    client->ip = ip_to_str(client_address.sin_addr.s_addr);
+    client->last_active = time(nullptr);
+
+    arm_recv(*loop.ring, client_fd, client->id);
+
+    active_connections++;
+    client_connected(client->ip);
+    loop.clients[client->id] = std::move(client);
+}
+
+void Server::ring_process(event_loop& loop, client_state& client) {
+    if (client.state != client_state::phase::reading)
+        return;
+
+    bool started;
+    try {
+        started = serve_request(loop, client);
+    } catch (...) {
+        Logger::instance().log(log_level::warning, log_event::client_error, client.ip);
+        ring_close(loop, client);
+        return;
+    }
+
+    if (!started) {
+        if (client.input.size() >= MAX_BUFFERED_INPUT)
+            Logger::instance().log(log_level::warning, log_event::too_large, client.ip);
+        if (client.peer_closed || client.input.size() >= MAX_BUFFERED_INPUT)
+            ring_close(loop, client);
+        return;
+    }
+    if (client.state == client_state::phase::writing)
+        ring_send(loop, client);
+}
+
+void Server::ring_send(event_loop& loop, client_state& client) {
+    io_uring_sqe* sqe = loop.ring->get_sqe();
+    // The message header must outlive the submission, so it lives in the client
+    // A sendmsg takes at most IOV_MAX pieces, the completion submits the rest
+    size_t count = std::min(client.output_iov.size() - client.output_index, (size_t)IOV_MAX);
+    client.output_msg = msghdr{};
+    client.output_msg.msg_iov = &client.output_iov[client.output_index];
+    client.output_msg.msg_iovlen = count;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = client.fd;
+    sqe->addr = (uint64_t)&client.output_msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = ring_data(client.id, RING_SEND);
+
+    if (!client.keep_alive && client.output_index + count == client.output_iov.size()) {
+        // The close is linked behind the last send so the response and the close leave in one submission
+        sqe->flags = IOSQE_IO_LINK;
+        ring_close(loop, client);
+    }
+}
+
+void Server::ring_close(event_loop& loop, client_state& client) {
+    if (client.state == client_state::phase::closing)
+        return;
+    client.state = client_state::phase::closing;
+
+    // Shutting the socket down ends the pending multishot receive, which would otherwise keep it open
+    io_uring_sqe* sqe = loop.ring->get_sqe();
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = client.fd;
+    sqe->len = SHUT_RDWR;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = ring_data(client.id, RING_SHUTDOWN);
+
+    sqe = loop.ring->get_sqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = client.fd;
+    sqe->user_data = ring_data(client.id, RING_CLOSE);
 }
 
 void Server::listen_for_clients(int max) {
     if (listen(fd, max))
         throw std::runtime_error("Can not listen for incoming connections");
+    max_connections = max;
     running = true;
     connections.clear();
-    start_server_loop();
+    if (mode == io_mode::io_uring && use_tls)
+        throw std::runtime_error("The io_uring backend does not support https");
+    if (mode != io_mode::threaded)
+        start_event_loops();
+    else
+        start_server_loop();
+}
+
+void Server::watch_static_files() {
+    static_files.watch();
+}
+
+void Server::use_compression(size_t min_size, int level) {
+    compress_responses = true;
+    compress_min_size = min_size;
+    compress_level = level;
+}
+
+void Server::use_static_files(const std::string &dir, size_t map_threshold) {
+    static_files.load(dir, map_threshold);
+}
+
+void Server::use_workers(int count) {
+    workers = std::make_unique<ThreadPool>(count);
 }
 
-void Server::use_static_files(const std::string &dir) {
-    static_files = get_all_files(dir);
+void Server::use_admission_control(std::chrono::milliseconds target, int initial_limit, int max_limit) {
+    admission = std::make_unique<AdmissionControl>(target, initial_limit, max_limit);
+}
+
+void Server::use_metrics(const std::string& route) {
+    metrics_controller = std::make_unique<MetricsController>(route);
+    add_route(*metrics_controller);
+}
+
+void Server::use_logging(log_level level, unsigned sample_every, const std::string& path) {
+    Logger& logger = Logger::instance();
+    logger.use_output(path);
+    logger.use_level(level);
+    logger.use_sampling(sample_every);
 }
 
 void Server::use_https(const std::string &cert_file, const std::string &key_file) {
@@ -273,19 +1605,23 @@ void Server::use_https(const std::string &cert_file, const std::string &key_file
 void Server::terminate() {
     running = false;
     close(fd);
-    if (use_tls) {
+    for (auto& loop: loops) {
+        if (loop->wake_fd != -1) {
+            uint64_t value = 1;
+            write(loop->wake_fd, &value, sizeof(value));
+        }
+    }
+    // Shutting the threaded connections down wakes their blocked reads, each thread closes and frees its own
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
         for (connection &c: connections) {
-            if (c.fd != -1) {
-                if (c.ssl != nullptr) {
-                    SSL_shutdown(c.ssl);
-                    SSL_free(c.ssl);
-                }
-                close(c.fd);
-            }
+            if (c.fd != -1)
+                shutdown(c.fd, SHUT_RDWR);
         }
+    }
+    if (use_tls && ssl_ctx != nullptr) {
         SSL_CTX_free(ssl_ctx);
+        ssl_ctx = nullptr;
         cleanup_openssl();
     }
-    else
-        for (connection &c: connections) close(c.fd);
 }
@@ -0,0 +1,417 @@
+#include "static_files.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "helpers.h"
+#include "compression.h"
+#include "logger.h"
+
+namespace fs = std::filesystem;
+
+// Strong validator from the content, FNV-1a is enough to tell two versions of a file apart
+static std::string make_etag(const std::vector<char>& body) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c: body) {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ULL;
+    }
+
+    char etag[48];
+    std::snprintf(etag, sizeof(etag), "\"%zx-%llx\"", body.size(), (unsigned long long)hash);
+    return etag;
+}
+
+// Hashing a large file would read it all, its size and modification time identify the version instead
+static std::string make_etag(size_t size, const struct stat& info) {
+    char etag[48];
+    std::snprintf(etag, sizeof(etag), "\"%zx-%llx\"", size, (unsigned long long)info.st_mtime);
+    return etag;
+}
+
+// The gzip variant is a different representation, so it needs its own validator
+static std::string gzip_etag(const std::string& etag) {
+    return etag.substr(0, etag.size() - 1) + "-gz\"";
+}
+
+// Headers shared by the 200 and the 304 of a representation
+static std::string validators(const static_asset& asset, const static_variant& variant) {
+    std::string headers;
+    headers += "ETag: ";
+    headers += variant.etag;
+    headers += "\r\nLast-Modified: ";
+    headers += asset.last_modified;
+    // Caches must key the compressible files on Accept-Encoding, even the identity variant
+    if (http::compressible(asset.content_type))
+        headers += "\r\nVary: Accept-Encoding";
+    headers += "\r\n";
+    return headers;
+}
+
+static std::string make_head(const static_asset& asset, const static_variant& variant, bool gzip, const char* connection) {
+    std::string head;
+    head.reserve(256 + asset.content_type.size());
+    head += "HTTP/1.1 200 OK\r\n";
+    head += "Content-Type: ";
+    head += asset.content_type;
+    head += "\r\nContent-Length: ";
+    head += std::to_string(gzip ? asset.gzip_body.size() : asset.size);
+    head += "\r\n";
+    if (gzip)
+        head += "Content-Encoding: gzip\r\n";
+    else
+        head += "Accept-Ranges: bytes\r\n"; // ranges are served from the identity variant only
+    head += validators(asset, variant);
+    head += "Connection: ";
+    head += connection;
+    head += "\r\n\r\n";
+    return head;
+}
+
+// A 304 has no body, so no Content-Length either
+static std::string make_not_modified(const static_asset& asset, const static_variant& variant, const char* connection) {
+    std::string head;
+    head.reserve(192);
+    head += "HTTP/1.1 304 Not Modified\r\n";
+    head += validators(asset, variant);
+    head += "Connection: ";
+    head += connection;
+    head += "\r\n\r\n";
+    return head;
+}
+
+static void make_heads(const static_asset& asset, static_variant& variant, bool gzip) {
+    variant.head_keep_alive = make_head(asset, variant, gzip, "keep-alive");
+    variant.head_close = make_head(asset, variant, gzip, "close");
+    variant.not_modified_keep_alive = make_not_modified(asset, variant, "keep-alive");
+    variant.not_modified_close = make_not_modified(asset, variant, "close");
+}
+
+static_asset::~static_asset() {
+    const char* data = mapped.load(std::memory_order_relaxed);
+    if (data != nullptr)
+        munmap((void*)data, size);
+}
+
+std::string_view static_asset::content() const {
+    if (path.empty())
+        return std::string_view(body.data(), body.size());
+
+    // An exception leaves the flag unset, a file that couldn't be mapped is tried again on the next request
+    std::call_once(map_once, [this]() {
+        // The descriptor is only held to create the mapping, the open files don't grow with the mapped ones
+        int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file < 0)
+            throw std::runtime_error("Failed to open static file " + path + ": " + std::strerror(errno));
+        // The file is mapped with the size it had when loaded, another version is left to the watcher
+        struct stat info;
+        if (fstat(file, &info) != 0 || info.st_ino != inode || (size_t)info.st_size != size ||
+            info.st_mtim.tv_sec != changed.tv_sec || info.st_mtim.tv_nsec != changed.tv_nsec) {
+            close(file);
+            throw std::runtime_error("Static file changed since it was loaded " + path);
+        }
+        // The pages are loaded on demand and shared with the page cache, only what is sent gets resident
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Failed to map static file " + path + ": " + std::strerror(errno));
+        madvise(data, size, MADV_SEQUENTIAL);
+        mapped.store((const char*)data, std::memory_order_release);
+    });
+    return std::string_view(mapped.load(std::memory_order_acquire), size);
+}
+
+// A file that can't be read is left out of the snapshot, but not silently
+static void load_failed(const std::string& path, int error) {
+    // A file removed since it was listed is not an error, the watcher sees the removal
+    if (error != ENOENT)
+        Logger::instance().message(log_level::error, "Failed to load static file " + path + ": " + std::strerror(error));
+}
+
+// Reads (or indexes, above map_threshold) a single file, nullptr when it isn't a regular file anymore
+// A large file is only stat'd, a small one is read from the descriptor it was stat'd with so a file
+// replaced in between can't mix the size of one version with the bytes of another
+static std::shared_ptr<static_asset> load_asset(const std::string& path, const std::string& uri, size_t map_threshold) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        load_failed(path, errno);
+        return nullptr;
+    }
+    if (!S_ISREG(info.st_mode))
+        return nullptr;
+
+    std::shared_ptr<static_asset> asset = std::make_shared<static_asset>();
+    if ((size_t)info.st_size > map_threshold) {
+        asset->path = path;
+        asset->inode = info.st_ino;
+        asset->size = (size_t)info.st_size;
+        asset->identity.etag = make_etag(asset->size, info);
+    } else {
+        // O_NONBLOCK so a fifo swapped in doesn't block the open, it has no effect on a regular file
+        int file = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+        if (file < 0) {
+            load_failed(path, errno);
+            return nullptr;
+        }
+        if (fstat(file, &info) != 0 || !S_ISREG(info.st_mode)) {
+            close(file);
+            return nullptr;
+        }
+        asset->body.resize((size_t)info.st_size);
+        size_t done = 0;
+        while (done < asset->body.size()) {
+            ssize_t length = pread(file, asset->body.data() + done, asset->body.size() - done, (off_t)done);
+            if (length < 0 && errno == EINTR)
+                continue;
+            if (length <= 0)
+                break;
+            done += (size_t)length;
+        }
+        close(file);
+        // A file shrinking while it is read is served as read, the watcher reloads the final version
+        asset->body.resize(done);
+        asset->size = done;
+        asset->identity.etag = make_etag(asset->body);
+    }
+    asset->content_type = get_content_type(uri);
+    asset->modified = info.st_mtime;
+    asset->changed = info.st_mtim;
+    asset->last_modified = http_date(info.st_mtime);
+    make_heads(*asset, asset->identity, false);
+
+    // Only the files held in memory are precompressed, a mapped file would be read whole and
+    // its compressed copy kept resident, defeating the mapping, large files are served as is
+    if (http::compressible(asset->content_type) && asset->size > 0 && asset->path.empty()) {
+        std::string compressed = http::compress(asset->content(), http::content_coding::gzip, 9);
+        if (compressed.size() < asset->size) {
+            asset->gzip_body.assign(compressed.begin(), compressed.end());
+            asset->gzip.etag = gzip_etag(asset->identity.etag);
+            make_heads(*asset, asset->gzip, true);
+        }
+    }
+    return asset;
+}
+
+StaticFiles::~StaticFiles() {
+    if (watcher.joinable()) {
+        uint64_t value = 1;
+        write(stop_fd, &value, sizeof(value));
+        watcher.join();
+    }
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+    if (stop_fd >= 0)
+        close(stop_fd);
+}
+
+void StaticFiles::publish(std::shared_ptr<const asset_map> next) {
+    assets.store(std::move(next), std::memory_order_release);
+}
+
+void StaticFiles::load(const std::string& dir, size_t map_threshold) {
+    root = dir;
+    this->map_threshold = map_threshold;
+
+    std::shared_ptr<asset_map> loaded = std::make_shared<asset_map>();
+    if (fs::exists(dir) && fs::is_directory(dir)) {
+        for (const auto& entry: fs::recursive_directory_iterator(dir)) {
+            if (!entry.is_regular_file())
+                continue;
+            std::string uri = "/" + fs::relative(entry.path(), dir).generic_string();
+            std::shared_ptr<static_asset> asset = load_asset(entry.path(), uri, map_threshold);
+            if (asset)
+                (*loaded)[uri] = std::move(asset);
+        }
+    }
+    publish(std::move(loaded));
+}
+
+void StaticFiles::watch() {
+    if (watcher.joinable())
+        return;
+    if (root.empty() || !fs::is_directory(root))
+        throw std::runtime_error("Static files directory does not exist");
+
+    inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_fd < 0)
+        throw std::runtime_error("Failed to create the inotify instance");
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_fd < 0)
+        throw std::runtime_error("Failed to create the watcher eventfd");
+
+    watch_dir(root);
+    for (const auto& entry: fs::recursive_directory_iterator(root)) {
+        if (entry.is_directory())
+            watch_dir(entry.path());
+    }
+    watcher = std::thread(&StaticFiles::run_watcher, this);
+}
+
+void StaticFiles::watch_dir(const std::string& dir) {
+    // Files are picked up once written and closed, or moved in as a whole, never half written
+    uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_ATTRIB | IN_ONLYDIR;
+    int wd = inotify_add_watch(inotify_fd, dir.c_str(), mask);
+    if (wd >= 0)
+        watched_dirs[wd] = dir;
+}
+
+void StaticFiles::unwatch_dir(const std::string& dir) {
+    // A moved directory keeps its watches, they would report under the old path
+    for (auto it = watched_dirs.begin(); it != watched_dirs.end(); ) {
+        const std::string& path = it->second;
+        if (path == dir || (path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 && path[dir.size()] == '/')) {
+            inotify_rm_watch(inotify_fd, it->first);
+            it = watched_dirs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void StaticFiles::run_watcher() {
+    pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+    alignas(inotify_event) char events[16384];
+
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (fds[1].revents & POLLIN)
+            return;
+
+        // A deploy touches many files at once, events are gathered until the directory is quiet for 50 ms
+        std::vector<std::string> changed;
+        do {
+            ssize_t length;
+            while ((length = read(inotify_fd, events, sizeof(events))) > 0) {
+                for (char* ptr = events; ptr < events + length; ) {
+                    inotify_event* event = (inotify_event*)ptr;
+                    ptr += sizeof(inotify_event) + event->len;
+
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        changed.push_back(root); // Events were lost, everything is reloaded
+                        continue;
+                    }
+                    auto dir = watched_dirs.find(event->wd);
+                    if (dir == watched_dirs.end())
+                        continue;
+                    if (event->mask & IN_IGNORED) {
+                        watched_dirs.erase(dir); // The directory is gone
+                        continue;
+                    }
+                    if (event->len == 0)
+                        continue;
+
+                    std::string path = dir->second + "/" + event->name;
+                    if ((event->mask & IN_ISDIR) && (event->mask & IN_MOVED_FROM))
+                        unwatch_dir(path);
+                    if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                        watch_dir(path);
+                        for (const auto& entry: fs::recursive_directory_iterator(path)) {
+                            if (entry.is_directory())
+                                watch_dir(entry.path());
+                        }
+                    }
+                    // A created file is loaded when closed, except for directories which are complete already
+                    if ((event->mask & IN_CREATE) && !(event->mask & IN_ISDIR))
+                        continue;
+                    changed.push_back(path);
+                }
+            }
+        } while (poll(fds, 1, 50) > 0);
+
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+        if (!changed.empty()) {
+            try {
+                apply_changes(changed);
+            } catch (...) {
+                Logger::instance().message(log_level::error, "Failed to reload the static files");
+            }
+        }
+    }
+}
+
+void StaticFiles::apply_changes(const std::vector<std::string>& changed) {
+    std::shared_ptr<const asset_map> current = snapshot();
+    // Copying the map only copies the pointers, the assets that didn't change are shared with the old snapshot
+    std::shared_ptr<asset_map> next = std::make_shared<asset_map>(*current);
+    size_t count = 0;
+
+    for (const std::string& path: changed) {
+        std::string relative = fs::relative(path, root).generic_string();
+        std::string uri = relative == "." ? "" : "/" + relative;
+
+        // The replies still sending a mapped file rewritten in place see the new bytes, or fault when it shrank
+        // A rename gives the path a new inode, the same one with another size or time was written over
+        auto previous = next->find(uri);
+        struct stat info;
+        if (previous != next->end() && previous->second->is_mapped() && stat(path.c_str(), &info) == 0 &&
+            info.st_ino == previous->second->inode &&
+            ((size_t)info.st_size != previous->second->size || info.st_mtim.tv_sec != previous->second->changed.tv_sec ||
+             info.st_mtim.tv_nsec != previous->second->changed.tv_nsec))
+            Logger::instance().message(log_level::warning, "Mapped file rewritten in place, rename instead: " + uri);
+
+        // Whatever was under the path is dropped, then what is there now is loaded back
+        for (auto it = next->begin(); it != next->end(); ) {
+            if (it->first == uri || (it->first.size() > uri.size() && it->first.compare(0, uri.size(), uri) == 0 &&
+                                     it->first[uri.size()] == '/'))
+                it = next->erase(it);
+            else
+                ++it;
+        }
+
+        std::error_code error;
+        if (fs::is_directory(path, error)) {
+            for (const auto& entry: fs::recursive_directory_iterator(path, error)) {
+                if (!entry.is_regular_file())
+                    continue;
+                std::string file_uri = "/" + fs::relative(entry.path(), root).generic_string();
+                std::shared_ptr<static_asset> asset = load_asset(entry.path(), file_uri, map_threshold);
+                if (asset)
+                    (*next)[file_uri] = std::move(asset);
+            }
+        } else {
+            std::shared_ptr<static_asset> asset = load_asset(path, uri, map_threshold);
+            if (asset)
+                (*next)[uri] = std::move(asset);
+        }
+        count++;
+    }
+
+    publish(std::move(next));
+    Logger::instance().message(log_level::info, "Static files reloaded: " + std::to_string(count) + " changes");
+}
+
+std::shared_ptr<const static_asset> StaticFiles::find(std::string_view uri) const {
+    std::shared_ptr<const asset_map> current = snapshot();
+    auto it = current->find(uri);
+    if (it != current->end())
+        return it->second;
+    if (uri == "/") {
+        it = current->find(std::string_view("/index.html"));
+        if (it != current->end())
+            return it->second;
+    }
+    return nullptr;
+}
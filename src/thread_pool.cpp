@@ -0,0 +1,112 @@
+#include "thread_pool.h"
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+
+// Index of the worker running on the current thread, -1 outside the pool
+static thread_local int current_worker = -1;
+static thread_local const ThreadPool* current_pool = nullptr;
+
+ThreadPool::ThreadPool(int count) {
+    if (count <= 0)
+        count = (int)std::thread::hardware_concurrency();
+    if (count <= 0)
+        count = 1;
+
+    for (int i = 0; i < count; i++)
+        workers.push_back(std::make_unique<worker>());
+    for (int i = 0; i < count; i++)
+        workers[i]->thread = std::thread(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    wait_idle();
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        running = false;
+    }
+    wake.notify_all();
+    for (auto& w: workers)
+        w->thread.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    int index;
+    if (current_pool == this)
+        index = current_worker;
+    else
+        index = (int)(next.fetch_add(1, std::memory_order_relaxed) % workers.size());
+
+    pending++;
+    queued++;
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+
+    // Taking the lock orders the notification after a worker that is about to sleep checked queued
+    { std::lock_guard<std::mutex> lock(sleep_mutex); }
+    wake.notify_one();
+}
+
+void ThreadPool::wait_idle() {
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    idle.wait(lock, [this] { return pending.load() == 0; });
+}
+
+bool ThreadPool::pop(int index, std::function<void()>& task) {
+    worker& w = *workers[index];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (w.tasks.empty())
+        return false;
+    task = std::move(w.tasks.back());
+    w.tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(int index, std::function<void()>& task) {
+    int count = (int)workers.size();
+    for (int i = 1; i < count; i++) {
+        worker& victim = *workers[(index + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(int index) {
+    current_worker = index;
+    current_pool = this;
+
+    std::function<void()> task;
+    while (true) {
+        if (pop(index, task) || steal(index, task)) {
+            queued--;
+            try {
+                task();
+            } catch (...) {
+                // A failing task must not take the worker down with it
+            }
+            task = nullptr;
+
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                idle.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake.wait(lock, [this] { return !running || queued.load() > 0; });
+        if (!running && queued.load() == 0)
+            return;
+    }
+}
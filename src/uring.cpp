@@ -0,0 +1,158 @@
+#include "uring.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <linux/io_uring.h>
+
+IoUring::IoUring(unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0)
+        throw std::runtime_error("Failed to create io_uring instance");
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+        sq_ring = nullptr;
+        close(fd);
+        throw std::runtime_error("Failed to map the io_uring submission queue");
+    }
+
+    if (single_mmap) {
+        cq_ring = sq_ring;
+    } else {
+        cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) {
+            cq_ring = nullptr;
+            munmap(sq_ring, sq_ring_size);
+            close(fd);
+            throw std::runtime_error("Failed to map the io_uring completion queue");
+        }
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd, IORING_OFF_SQES);
+    if (sqes_ptr == MAP_FAILED) {
+        if (cq_ring != sq_ring)
+            munmap(cq_ring, cq_ring_size);
+        munmap(sq_ring, sq_ring_size);
+        close(fd);
+        throw std::runtime_error("Failed to map the io_uring submission entries");
+    }
+    sqes = (io_uring_sqe*)sqes_ptr;
+
+    char* sq = (char*)sq_ring;
+    sq_head = (unsigned*)(sq + params.sq_off.head);
+    sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    sq_entries = *(unsigned*)(sq + params.sq_off.ring_entries);
+    sqe_tail = *sq_tail;
+
+    // The entries are always submitted in order, so the indirection array is the identity
+    unsigned* array = (unsigned*)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries; i++)
+        array[i] = i;
+
+    char* cq = (char*)cq_ring;
+    cq_head = (unsigned*)(cq + params.cq_off.head);
+    cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+    // Closing the ring cancels the requests still in flight
+    close(fd);
+    munmap(sqes, sqes_size);
+    if (cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    munmap(sq_ring, sq_ring_size);
+    if (buf_ring != nullptr)
+        munmap(buf_ring, buf_ring_size);
+    delete[] buffers;
+}
+
+io_uring_sqe* IoUring::get_sqe() {
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (sqe_tail - head >= sq_entries) {
+        submit();
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (sqe_tail - head >= sq_entries)
+            throw std::runtime_error("io_uring submission queue is full");
+    }
+
+    io_uring_sqe* sqe = &sqes[sqe_tail & sq_mask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe_tail++;
+    return sqe;
+}
+
+int IoUring::submit(unsigned wait_nr) {
+    unsigned to_submit = sqe_tail - *sq_tail;
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    if (to_submit == 0 && wait_nr == 0)
+        return 0;
+
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int result = (int)syscall(__NR_io_uring_enter, fd, to_submit, wait_nr, flags, nullptr, 0);
+    if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        throw std::runtime_error("Failed to submit to io_uring");
+    return result;
+}
+
+void IoUring::setup_buffers(uint16_t group, unsigned count, unsigned size) {
+    if (count == 0 || (count & (count - 1)) != 0)
+        throw std::invalid_argument("Buffers count must be a power of two");
+
+    buf_ring_size = count * sizeof(io_uring_buf);
+    void* ring_ptr = mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring_ptr == MAP_FAILED)
+        throw std::runtime_error("Failed to allocate the io_uring buffers ring");
+    buf_ring = (io_uring_buf_ring*)ring_ptr;
+
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(buf_ring, buf_ring_size);
+        buf_ring = nullptr;
+        throw std::runtime_error("Failed to register the io_uring buffers ring");
+    }
+
+    buffers = new char[(size_t)count * size];
+    buffer_count = count;
+    buffer_size = size;
+    buf_ring->tail = 0;
+    for (unsigned i = 0; i < count; i++)
+        recycle_buffer((uint16_t)i);
+}
+
+void IoUring::recycle_buffer(uint16_t id) {
+    // Not bufs[], its flexible array wrapper shifts it by one entry when compiled as C++
+    io_uring_buf* entries = (io_uring_buf*)buf_ring;
+    uint16_t tail = buf_ring->tail;
+    io_uring_buf* buf = &entries[tail & (buffer_count - 1)];
+    buf->addr = (uint64_t)buffer(id);
+    buf->len = buffer_size;
+    buf->bid = id;
+    __atomic_store_n(&buf_ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
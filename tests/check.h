@@ -0,0 +1,36 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <iostream>
+
+// Minimal assertions for the test programs, a failed check is reported and the program goes on
+// main returns check_result() so make test stops on the first failing program
+inline int check_failures = 0;
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+            check_failures++;                                                                \
+        }                                                                                    \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                                     \
+    do {                                                                                               \
+        auto&& check_actual = (actual);                                                                \
+        auto&& check_expected = (expected);                                                            \
+        if (!(check_actual == check_expected)) {                                                       \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #actual ", " #expected ") failed\n"; \
+            check_failures++;                                                                          \
+        }                                                                                              \
+    } while (0)
+
+inline int check_result(const char* name) {
+    if (check_failures == 0)
+        std::cout << name << ": ok" << std::endl;
+    else
+        std::cout << name << ": " << check_failures << " failed" << std::endl;
+    return check_failures == 0 ? 0 : 1;
+}
+
+#endif // CHECK_H
@@ -0,0 +1,157 @@
+// Controller: the verbs answered from the handlers a subclass overrides and the tables they are called through
+#include <string>
+#include <string_view>
+#include "controller.h"
+#include "check.h"
+
+static constexpr unsigned bit(http::verb v) {
+    return 1u << (unsigned)v;
+}
+
+class Nothing : public Controller {
+public:
+    Nothing(): Controller("nothing") {}
+};
+
+class PublicGet : public Controller {
+public:
+    PublicGet(): Controller("public") {}
+    http::response Get(http::request& req) override {
+        (void)req;
+        return http::ok("text/plain", "get");
+    }
+};
+
+class ProtectedPost : public Controller {
+protected:
+    http::response Post(http::request& req) override {
+        (void)req;
+        return http::ok("text/plain", "post");
+    }
+    http::response Delete(http::request& req) override {
+        (void)req;
+        return http::ok("text/plain", "delete");
+    }
+public:
+    ProtectedPost(): Controller("protected") {}
+};
+
+class PrivatePut : public Controller {
+    http::response Put(http::request& req) override {
+        (void)req;
+        return http::ok("text/plain", "put");
+    }
+    http::response Options(http::request& req) override {
+        (void)req;
+        return http::ok("text/plain", "options");
+    }
+public:
+    PrivatePut(): Controller("private") {}
+};
+
+// Get comes from the intermediate class, Patch from this one
+class Inherited : public PublicGet {
+    http::response Patch(http::request& req) override {
+        (void)req;
+        return http::ok("text/plain", "patch");
+    }
+};
+
+class CustomHandle : public Controller {
+public:
+    CustomHandle(): Controller("custom") {}
+    http::response handle(http::request& req) override {
+        return http::ok("text/plain", std::string(http::verb_name(req.verb)));
+    }
+};
+
+class AsyncGet : public AsyncController {
+    async::task<http::response> GetAsync(http::request& req) override {
+        (void)req;
+        co_return http::ok("text/plain", "get async");
+    }
+public:
+    AsyncGet(): AsyncController("async") {}
+};
+
+class AsyncHandle : public AsyncController {
+    async::task<http::response> handle_async(http::request& req) override {
+        (void)req;
+        co_return http::ok("text/plain", "handle async");
+    }
+public:
+    AsyncHandle(): AsyncController("async-handle") {}
+};
+
+// The masks are known at compile time, whatever the access of the overrides
+static_assert(Controller::handled_verbs<Nothing>() == 0);
+static_assert(Controller::handled_verbs<PublicGet>() == (bit(http::verb::get) | bit(http::verb::head)));
+static_assert(Controller::handled_verbs<ProtectedPost>() == (bit(http::verb::post) | bit(http::verb::delete_)));
+static_assert(Controller::handled_verbs<PrivatePut>() == (bit(http::verb::put) | bit(http::verb::options)));
+static_assert(Controller::handled_verbs<Inherited>() ==
+              (bit(http::verb::get) | bit(http::verb::head) | bit(http::verb::patch)));
+static_assert(Controller::handled_verbs<CustomHandle>() == ~0u);
+static_assert(AsyncController::handled_verbs<AsyncGet>() == (bit(http::verb::get) | bit(http::verb::head)));
+static_assert(AsyncController::handled_verbs<AsyncHandle>() == ~0u);
+
+template<typename T>
+static std::string call(T& controller, http::verb verb) {
+    http::request req;
+    req.verb = verb;
+    return controller.dispatch(req).body;
+}
+
+template<typename T>
+static std::string call_async(T& controller, http::verb verb) {
+    http::request req;
+    req.verb = verb;
+    return async::sync_wait(controller.dispatch_async(req)).body;
+}
+
+static void sync_tables() {
+    PublicGet get;
+    get.bind_handlers<PublicGet>();
+    CHECK_EQ(call(get, http::verb::get), "get");
+    CHECK_EQ(call(get, http::verb::head), "get");
+
+    ProtectedPost post;
+    post.bind_handlers<ProtectedPost>();
+    CHECK_EQ(call(post, http::verb::post), "post");
+    CHECK_EQ(call(post, http::verb::delete_), "delete");
+
+    PrivatePut put;
+    put.bind_handlers<PrivatePut>();
+    CHECK_EQ(call(put, http::verb::put), "put");
+    CHECK_EQ(call(put, http::verb::options), "options");
+
+    Inherited inherited;
+    inherited.bind_handlers<Inherited>();
+    CHECK_EQ(call(inherited, http::verb::get), "get");
+    CHECK_EQ(call(inherited, http::verb::patch), "patch");
+
+    // A custom handle answers every verb itself
+    CustomHandle custom;
+    custom.bind_handlers<CustomHandle>();
+    CHECK_EQ(call(custom, http::verb::get), "GET");
+    CHECK_EQ(call(custom, http::verb::delete_), "DELETE");
+}
+
+static void async_tables() {
+    AsyncGet get;
+    get.bind_handlers<AsyncGet>();
+    CHECK_EQ(call_async(get, http::verb::get), "get async");
+    CHECK_EQ(call_async(get, http::verb::head), "get async");
+    // The synchronous table of the threaded mode waits for the same coroutine
+    CHECK_EQ(call(get, http::verb::get), "get async");
+
+    AsyncHandle custom;
+    custom.bind_handlers<AsyncHandle>();
+    CHECK_EQ(call_async(custom, http::verb::put), "handle async");
+    CHECK_EQ(call(custom, http::verb::post), "handle async");
+}
+
+int main() {
+    sync_tables();
+    async_tables();
+    return check_result("controller_test");
+}
@@ -0,0 +1,165 @@
+// header_map: case insensitive lookups and the overflow past the inline entries
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "header_map.h"
+#include "check.h"
+
+using http::header_map;
+
+static const size_t COUNT = 3 * header_map::INLINE_HEADERS;
+
+static std::string name_of(size_t i) {
+    return "X-Header-" + std::to_string(i);
+}
+
+static std::string value_of(size_t i) {
+    // Longer than the small string buffer so the values allocate
+    return "value " + std::to_string(i) + " of a header long enough";
+}
+
+static header_map filled(const header_map::allocator_type& alloc = {}) {
+    header_map headers(alloc);
+    for (size_t i = 0; i < COUNT; i++)
+        headers[name_of(i)] = value_of(i);
+    return headers;
+}
+
+// Every header is found in any case and the iteration keeps the insertion order
+static void check_all(const header_map& headers) {
+    CHECK_EQ(headers.size(), COUNT);
+    size_t i = 0;
+    for (const auto& header: headers) {
+        CHECK_EQ(std::string_view(header.first), name_of(i));
+        CHECK_EQ(std::string_view(header.second), value_of(i));
+        i++;
+    }
+    CHECK_EQ(i, COUNT);
+    for (i = 0; i < COUNT; i++) {
+        std::string lower = "x-header-" + std::to_string(i);
+        std::string upper = "X-HEADER-" + std::to_string(i);
+        auto it = headers.find(lower);
+        CHECK(it != headers.end());
+        if (it != headers.end())
+            CHECK_EQ(std::string_view(it->second), value_of(i));
+        CHECK(headers.contains(upper));
+    }
+}
+
+static void overflow() {
+    header_map headers = filled();
+    check_all(headers);
+    CHECK(!headers.contains("X-Header-" + std::to_string(COUNT)));
+
+    // An existing name is updated in place, emplace keeps the first value
+    headers["x-header-20"] = "updated";
+    CHECK_EQ(headers.size(), COUNT);
+    CHECK_EQ(headers.at("X-Header-20"), "updated");
+    CHECK(!headers.emplace("X-HEADER-20", "ignored").second);
+    CHECK_EQ(headers.at("X-Header-20"), "updated");
+
+    bool thrown = false;
+    try {
+        headers.at("Missing");
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+static void well_known_fields() {
+    header_map headers = filled();
+    headers[http::field::content_type] = "text/plain";
+    headers["connection"] = "close";
+    CHECK_EQ(headers.at("Content-Type"), "text/plain");
+    CHECK_EQ(headers[http::field::connection], "close");
+    CHECK(headers.contains(http::field::content_type));
+    CHECK(!headers.contains(http::field::host));
+    CHECK_EQ(headers.size(), COUNT + 2);
+}
+
+static void erase_keeps_order() {
+    header_map headers = filled();
+    CHECK_EQ(headers.erase("X-HEADER-0"), 1u);
+    CHECK_EQ(headers.erase("X-Header-0"), 0u);
+    headers.erase(headers.find("x-header-30"));
+    CHECK_EQ(headers.size(), COUNT - 2);
+
+    size_t expected = 1;
+    for (const auto& header: headers) {
+        if (expected == 30)
+            expected++;
+        CHECK_EQ(std::string_view(header.first), name_of(expected));
+        expected++;
+    }
+    CHECK(headers.contains("X-Header-47"));
+    CHECK(!headers.contains("X-Header-30"));
+
+    headers.clear();
+    CHECK(headers.empty());
+    headers["Host"] = "localhost";
+    CHECK_EQ(headers.at("host"), "localhost");
+}
+
+static void copy_and_move() {
+    header_map headers = filled();
+
+    header_map copy(headers);
+    check_all(copy);
+    copy["X-Header-0"] = "changed";
+    CHECK_EQ(std::string_view(headers.at("X-Header-0")), value_of(0));
+
+    // A move takes the overflow array as is and leaves an empty map behind
+    header_map moved(std::move(headers));
+    check_all(moved);
+    CHECK(headers.empty());
+    headers["Reused"] = "yes";
+    CHECK_EQ(headers.at("reused"), "yes");
+
+    header_map assigned;
+    assigned["Old"] = "gone";
+    assigned = moved;
+    check_all(assigned);
+    CHECK(!assigned.contains("Old"));
+
+    header_map move_assigned;
+    move_assigned = std::move(moved);
+    check_all(move_assigned);
+    CHECK(moved.empty());
+}
+
+static void other_resources() {
+    alignas(std::max_align_t) char storage[65536];
+    std::pmr::monotonic_buffer_resource arena(storage, sizeof(storage), std::pmr::null_memory_resource());
+
+    // The overflow entries and the strings come from the resource of the map
+    header_map headers = filled(&arena);
+    check_all(headers);
+    CHECK(headers.get_allocator().resource() == &arena);
+    CHECK(headers.begin()->second.get_allocator().resource() == &arena);
+
+    // Copied or moved to a map of another resource, the entries are rebuilt in it
+    header_map copy(headers);
+    check_all(copy);
+    CHECK(copy.get_allocator().resource() == std::pmr::get_default_resource());
+    CHECK(copy.begin()->second.get_allocator().resource() == std::pmr::get_default_resource());
+
+    header_map moved(std::move(headers), {});
+    check_all(moved);
+    CHECK(moved.begin()->second.get_allocator().resource() == std::pmr::get_default_resource());
+
+    header_map assigned;
+    assigned = filled(&arena);
+    check_all(assigned);
+    CHECK(assigned.begin()->second.get_allocator().resource() == std::pmr::get_default_resource());
+}
+
+int main() {
+    overflow();
+    well_known_fields();
+    erase_keeps_order();
+    copy_and_move();
+    other_resources();
+    return check_result("header_map_test");
+}
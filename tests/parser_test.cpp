@@ -0,0 +1,178 @@
+// request_parser: head size cap, body framing and the owning request
+#include <memory_resource>
+#include <string>
+#include "http.hpp"
+#include "check.h"
+
+using http::parse_status;
+
+static std::string head_with_padding(size_t padding) {
+    return "GET /padded HTTP/1.1\r\nHost: localhost\r\nX-Padding: " + std::string(padding, 'a') + "\r\n\r\n";
+}
+
+static void complete_request() {
+    http::request_parser parser;
+    std::string buffer = "GET /users/42?x=1 HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\n\r\nGET /next HTTP/1.1\r\n";
+    CHECK(parser.parse(buffer) == parse_status::complete);
+    const http::request_view& req = parser.request();
+    CHECK_EQ(req.method, "GET");
+    CHECK(req.verb == http::verb::get);
+    CHECK_EQ(req.target, "/users/42?x=1");
+    CHECK_EQ(req.version, "HTTP/1.1");
+    CHECK_EQ(req.header("host"), "localhost");
+    CHECK_EQ(req.headers.size(), 2u);
+    // The pipelined request that follows is left in the buffer
+    CHECK_EQ(req.size, buffer.find("GET /next"));
+}
+
+static void head_under_cap() {
+    http::request_parser parser;
+    std::string buffer = head_with_padding(http::request_parser::MAX_HEAD_SIZE - 100);
+    CHECK(buffer.size() <= http::request_parser::MAX_HEAD_SIZE);
+    CHECK(parser.parse(buffer) == parse_status::complete);
+}
+
+static void unterminated_head_over_cap() {
+    // A line without its end past the cap is refused instead of buffered forever
+    http::request_parser parser;
+    std::string buffer = "GET / HTTP/1.1\r\nX-Padding: " + std::string(http::request_parser::MAX_HEAD_SIZE, 'a');
+    CHECK(parser.parse(buffer) == parse_status::error);
+
+    http::request_parser line_parser;
+    std::string line = "GET /" + std::string(http::request_parser::MAX_HEAD_SIZE, 'a');
+    CHECK(line_parser.parse(line) == parse_status::error);
+}
+
+static void complete_head_over_cap() {
+    // Many short headers add up past the cap even when every line ends in the buffer
+    http::request_parser parser;
+    std::string buffer = "GET / HTTP/1.1\r\n";
+    for (int i = 0; buffer.size() <= http::request_parser::MAX_HEAD_SIZE; i++)
+        buffer += "X-Header-" + std::to_string(i) + ": " + std::string(64, 'v') + "\r\n";
+    buffer += "\r\n";
+    CHECK(parser.parse(buffer) == parse_status::error);
+}
+
+static void head_growing_over_cap() {
+    // Fed a piece at a time, the head needs more until it crosses the cap
+    http::request_parser parser;
+    std::string head = head_with_padding(2 * http::request_parser::MAX_HEAD_SIZE);
+    std::string buffer;
+    parse_status status = parse_status::need_more;
+    size_t offset = 0;
+    while (status == parse_status::need_more && offset < head.size()) {
+        buffer.append(head, offset, 4096);
+        offset += 4096;
+        status = parser.parse(buffer);
+    }
+    CHECK(status == parse_status::error);
+    CHECK(buffer.size() <= http::request_parser::MAX_HEAD_SIZE + 4096);
+}
+
+static parse_status parse_once(const std::string& buffer) {
+    http::request_parser parser;
+    return parser.parse(buffer);
+}
+
+static void content_length_body() {
+    http::request_parser parser;
+    std::string buffer = "POST /echo HTTP/1.1\r\nContent-Length: 5\r\n\r\nhelloGET / HTTP/1.1\r\n\r\n";
+    CHECK(parser.parse(buffer.substr(0, buffer.find("hello") + 2)) == parse_status::need_more);
+    CHECK(parser.parse(buffer) == parse_status::complete);
+    CHECK_EQ(parser.request().body, "hello");
+    CHECK_EQ(parser.request().size, buffer.find("GET /"));
+}
+
+static void conflicting_content_length() {
+    // Two different lengths are refused, the same length repeated is harmless
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\nhello!") == parse_status::error);
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\nhello") == parse_status::complete);
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: 5, 6\r\n\r\nhello!") == parse_status::error);
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n") == parse_status::error);
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length:\r\n\r\n") == parse_status::error);
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n") == parse_status::error);
+}
+
+static void chunked_with_content_length() {
+    // Either order, the two framings together are a smuggling attempt
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n"
+                     "3\r\nabc\r\n0\r\n\r\n") == parse_status::error);
+    CHECK(parse_once("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 3\r\n\r\n"
+                     "3\r\nabc\r\n0\r\n\r\n") == parse_status::error);
+    // chunked has to be the last coding
+    CHECK(parse_once("POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n") == parse_status::error);
+}
+
+static void chunked_body() {
+    http::request_parser parser;
+    std::string buffer = "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n"
+                         "5;name=value\r\nhello\r\n7\r\n, world\r\n0\r\nX-Trailer: 1\r\n\r\n"
+                         "GET / HTTP/1.1\r\n\r\n";
+    // Fed a byte at a time the decoder resumes where it stopped
+    parse_status status = parse_status::need_more;
+    size_t length = 0;
+    while (status == parse_status::need_more && length < buffer.size())
+        status = parser.parse(std::string_view(buffer).substr(0, ++length));
+    CHECK(status == parse_status::complete);
+    CHECK_EQ(parser.request().body, "hello, world");
+    CHECK_EQ(parser.request().size, buffer.find("GET /"));
+
+    CHECK(parse_once("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n") == parse_status::error);
+    CHECK(parse_once("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabcX\r\n") == parse_status::error);
+}
+
+static void body_too_large() {
+    std::string length = std::to_string(http::request_parser::MAX_BODY_SIZE + 1);
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: " + length + "\r\n\r\n") == parse_status::too_large);
+}
+
+static void owning_request() {
+    http::request_parser parser;
+    std::string buffer = "POST //users//42/?a=1&&b&a=2 HTTP/1.1\r\nHost: localhost\r\nContent-Length: 4\r\n\r\nbody";
+    CHECK(parser.parse(buffer) == parse_status::complete);
+
+    // Every member comes from the resource it is built with, the null upstream refuses any overflow
+    alignas(std::max_align_t) char storage[16384];
+    std::pmr::monotonic_buffer_resource arena(storage, sizeof(storage), std::pmr::null_memory_resource());
+    http::request req = parser.request().to_request(&arena);
+    CHECK_EQ(req.method, "POST");
+    CHECK_EQ(req.body, "body");
+    CHECK(req.body.get_allocator().resource() == &arena);
+    CHECK(req.headers.get_allocator().resource() == &arena);
+    CHECK(req.headers.begin()->second.get_allocator().resource() == &arena);
+    CHECK(req.uri.route.get_allocator().resource() == &arena);
+    CHECK(req.uri.parameters.get_allocator().resource() == &arena);
+
+    // Empty segments and parameters are skipped, a parameter without a value is empty and the last repeated one wins
+    CHECK_EQ(req.uri.route.size(), 2u);
+    if (req.uri.route.size() == 2) {
+        CHECK_EQ(req.uri.route[0], "users");
+        CHECK_EQ(req.uri.route[1], "42");
+        CHECK(req.uri.route[1].get_allocator().resource() == &arena);
+    }
+    CHECK_EQ(req.uri.parameters.count(""), 0u);
+    CHECK_EQ(req.uri.parameters.size(), 2u);
+    CHECK_EQ(req.uri.parameters["a"], "2");
+    CHECK_EQ(req.uri.parameters["b"], "");
+
+    // A copy without an allocator outlives the arena on the heap
+    http::request copy = req;
+    CHECK(copy.body.get_allocator().resource() == std::pmr::get_default_resource());
+    CHECK(copy.headers.begin()->second.get_allocator().resource() == std::pmr::get_default_resource());
+    CHECK_EQ(copy.headers["HOST"], "localhost");
+}
+
+int main() {
+    complete_request();
+    head_under_cap();
+    unterminated_head_over_cap();
+    complete_head_over_cap();
+    head_growing_over_cap();
+    content_length_body();
+    conflicting_content_length();
+    chunked_with_content_length();
+    chunked_body();
+    body_too_large();
+    owning_request();
+    return check_result("parser_test");
+}
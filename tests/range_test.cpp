@@ -0,0 +1,184 @@
+// Range requests on static files: suffix, multiple and unsatisfiable ranges
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include "server.h"
+#include "check.h"
+
+namespace fs = std::filesystem;
+
+static const uint16_t PORT = 18413;
+static const size_t FILE_SIZE = 1000;
+
+struct answer {
+    std::string head;
+    std::string body;
+};
+
+// Sends one request with Connection: close and reads the answer until the server closes
+static answer request(const std::string& path, const std::string& headers) {
+    answer out;
+    int fd = -1;
+    for (int attempt = 0; attempt < 100; attempt++) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(PORT);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(fd, (sockaddr*)&address, sizeof(address)) == 0)
+            break;
+        close(fd);
+        fd = -1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    if (fd < 0)
+        return out;
+
+    std::string text = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n" + headers + "\r\n";
+    send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+    std::string received;
+    char buffer[4096];
+    ssize_t length;
+    while ((length = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+        received.append(buffer, length);
+    close(fd);
+
+    size_t end = received.find("\r\n\r\n");
+    if (end == std::string::npos)
+        return out;
+    out.head = received.substr(0, end + 2);
+    out.body = received.substr(end + 4);
+    return out;
+}
+
+static std::string header(const answer& a, const std::string& name) {
+    size_t start = a.head.find("\r\n" + name + ": ");
+    if (start == std::string::npos)
+        return "";
+    start += name.size() + 4;
+    return a.head.substr(start, a.head.find("\r\n", start) - start);
+}
+
+static bool status_is(const answer& a, const std::string& status) {
+    return a.head.compare(0, 9 + status.size(), "HTTP/1.1 " + status) == 0;
+}
+
+static void suffix_ranges(const std::string& path, const std::string& content) {
+    answer a = request(path, "Range: bytes=-100\r\n");
+    CHECK(status_is(a, "206"));
+    CHECK_EQ(header(a, "Content-Range"), "bytes 900-999/1000");
+    CHECK_EQ(a.body, content.substr(900));
+
+    // A suffix longer than the file is the whole file
+    a = request(path, "Range: bytes=-5000\r\n");
+    CHECK(status_is(a, "206"));
+    CHECK_EQ(header(a, "Content-Range"), "bytes 0-999/1000");
+    CHECK_EQ(a.body, content);
+
+    a = request(path, "Range: bytes=990-\r\n");
+    CHECK(status_is(a, "206"));
+    CHECK_EQ(header(a, "Content-Range"), "bytes 990-999/1000");
+    CHECK_EQ(a.body, content.substr(990));
+
+    // The end is clamped to the last byte
+    a = request(path, "Range: bytes=995-2000\r\n");
+    CHECK(status_is(a, "206"));
+    CHECK_EQ(header(a, "Content-Range"), "bytes 995-999/1000");
+    CHECK_EQ(a.body, content.substr(995));
+}
+
+static void multiple_ranges(const std::string& path, const std::string& content) {
+    answer a = request(path, "Range: bytes=0-9, 20-29,-5\r\n");
+    CHECK(status_is(a, "206"));
+    std::string type = header(a, "Content-Type");
+    std::string prefix = "multipart/byteranges; boundary=";
+    CHECK(type.compare(0, prefix.size(), prefix) == 0);
+    std::string boundary = type.substr(prefix.size());
+    CHECK_EQ(std::to_string(a.body.size()), header(a, "Content-Length"));
+
+    // Every part carries its own Content-Range and the slice, then the closing boundary
+    size_t position = 0;
+    const std::pair<size_t, size_t> ranges[] = {{0, 9}, {20, 29}, {995, 999}};
+    for (auto& range: ranges) {
+        std::string part = "--" + boundary + "\r\n";
+        position = a.body.find(part, position);
+        CHECK(position != std::string::npos);
+        if (position == std::string::npos)
+            return;
+        std::string content_range = "Content-Range: bytes " + std::to_string(range.first) + "-" +
+                                    std::to_string(range.second) + "/1000\r\n\r\n";
+        position = a.body.find(content_range, position);
+        CHECK(position != std::string::npos);
+        if (position == std::string::npos)
+            return;
+        position += content_range.size();
+        size_t length = range.second - range.first + 1;
+        CHECK_EQ(a.body.substr(position, length), content.substr(range.first, length));
+        position += length;
+    }
+    CHECK_EQ(a.body.substr(position), "\r\n--" + boundary + "--\r\n");
+}
+
+static void unsatisfiable_ranges(const std::string& path) {
+    answer a = request(path, "Range: bytes=5000-6000\r\n");
+    CHECK(status_is(a, "416"));
+    CHECK_EQ(header(a, "Content-Range"), "bytes */1000");
+    CHECK(a.body.empty());
+
+    a = request(path, "Range: bytes=-0\r\n");
+    CHECK(status_is(a, "416"));
+
+    a = request(path, "Range: bytes=1000-, 2000-3000\r\n");
+    CHECK(status_is(a, "416"));
+}
+
+static void ignored_ranges(const std::string& path, const std::string& content) {
+    // A malformed or stale Range gets the whole file
+    answer a = request(path, "Range: bytes=abc\r\n");
+    CHECK(status_is(a, "200"));
+    CHECK_EQ(a.body, content);
+
+    a = request(path, "Range: bytes=20-10\r\n");
+    CHECK(status_is(a, "200"));
+
+    a = request(path, "Range: items=0-10\r\n");
+    CHECK(status_is(a, "200"));
+
+    a = request(path, "Range: bytes=0-9\r\nIf-Range: \"stale\"\r\n");
+    CHECK(status_is(a, "200"));
+    CHECK_EQ(a.body, content);
+}
+
+int main() {
+    fs::path dir = fs::temp_directory_path() / ("range_test_" + std::to_string(getpid()));
+    fs::create_directories(dir);
+    std::string content;
+    for (size_t i = 0; i < FILE_SIZE; i++)
+        content += (char)('a' + i % 26);
+    std::ofstream(dir / "data.bin", std::ios::binary) << content;
+
+    Server server("127.0.0.1", PORT, io_mode::epoll, 1);
+    server.use_logging(log_level::off);
+    server.use_static_files(dir.string());
+    std::thread listener([&server]() { server.listen_for_clients(16); });
+
+    // Held in memory first, then mapped, both serve the ranges from their bytes
+    for (size_t map_threshold: {StaticFiles::DEFAULT_MAP_THRESHOLD, (size_t)0}) {
+        server.use_static_files(dir.string(), map_threshold);
+        suffix_ranges("/data.bin", content);
+        multiple_ranges("/data.bin", content);
+        unsatisfiable_ranges("/data.bin");
+        ignored_ranges("/data.bin", content);
+    }
+
+    server.terminate();
+    listener.join();
+    fs::remove_all(dir);
+    return check_result("range_test");
+}
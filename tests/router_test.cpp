@@ -0,0 +1,184 @@
+// Router: static segments, captures and their precedence
+#include <map>
+#include <memory_resource>
+#include <string>
+#include "router.h"
+#include "controller.h"
+#include "http.hpp"
+#include "check.h"
+
+struct match_result {
+    Controller* controller = nullptr;
+    std::pmr::map<std::pmr::string, std::pmr::string> params;
+    unsigned verbs = 0;
+};
+
+// The path is split into segments the way the requests are
+static match_result match(const Router& router, const std::string& path) {
+    match_result result;
+    result.controller = router.match(http::URI(path).route, result.params, result.verbs);
+    return result;
+}
+
+static void static_over_capture() {
+    Controller user("users/:id");
+    Controller me("users/me");
+    Router router;
+    router.add(user.get_route(), &user);
+    router.add(me.get_route(), &me);
+
+    match_result m = match(router, "/users/me");
+    CHECK(m.controller == &me);
+    CHECK(m.params.empty());
+
+    m = match(router, "/users/42");
+    CHECK(m.controller == &user);
+    CHECK_EQ(m.params["id"], "42");
+
+    // The order the routes are added in doesn't matter
+    Router reversed;
+    reversed.add(me.get_route(), &me);
+    reversed.add(user.get_route(), &user);
+    CHECK(match(reversed, "/users/me").controller == &me);
+    CHECK(match(reversed, "/users/7").controller == &user);
+}
+
+static void deeper_capture_over_static() {
+    // A capture takes over from a static segment when only it leads to a deeper route
+    Controller me("users/me");
+    Controller orders("users/:id/orders");
+    Router router;
+    router.add(me.get_route(), &me);
+    router.add(orders.get_route(), &orders);
+
+    match_result m = match(router, "/users/me/orders");
+    CHECK(m.controller == &orders);
+    CHECK_EQ(m.params["id"], "me");
+
+    // Below its route the static one still owns the subtree
+    CHECK(match(router, "/users/me/settings").controller == &me);
+}
+
+static void first_static_segment_wins() {
+    // At equal depth the route with a static segment earlier in the path wins
+    Controller late("a/:x/c");
+    Controller early("a/b/:y");
+    Router router;
+    router.add(late.get_route(), &late);
+    router.add(early.get_route(), &early);
+
+    match_result m = match(router, "/a/b/c");
+    CHECK(m.controller == &early);
+    CHECK_EQ(m.params["y"], "c");
+    CHECK(m.params.count("x") == 0);
+
+    m = match(router, "/a/z/c");
+    CHECK(m.controller == &late);
+    CHECK_EQ(m.params["x"], "z");
+}
+
+static void subtrees_and_misses() {
+    Controller users("users");
+    Controller orders("users/:id/orders");
+    Controller root("/");
+    Router router;
+    router.add(users.get_route(), &users);
+    router.add(orders.get_route(), &orders, 1u << (unsigned)http::verb::get);
+
+    // The deepest matching route owns the requests below it
+    match_result m = match(router, "/users/42/orders/7");
+    CHECK(m.controller == &orders);
+    CHECK_EQ(m.params["id"], "42");
+    CHECK_EQ(m.verbs, 1u << (unsigned)http::verb::get);
+    CHECK(match(router, "/users/42").controller == &users);
+    CHECK(match(router, "/products").controller == nullptr);
+
+    // Doubled and trailing slashes are ignored in the routes
+    Controller slashes("//products//:id/");
+    router.add(slashes.get_route(), &slashes);
+    m = match(router, "/products/9");
+    CHECK(m.controller == &slashes);
+    CHECK_EQ(m.params["id"], "9");
+
+    // The root route is the fallback of everything
+    router.add(root.get_route(), &root);
+    CHECK(match(router, "/products").controller == &root);
+    CHECK(match(router, "/").controller == &root);
+}
+
+static void captures_with_several_names() {
+    Controller item("shops/:shop/items/:item");
+    Controller other("shops/:name/about");
+    Router router;
+    router.add(item.get_route(), &item);
+    router.add(other.get_route(), &other);
+
+    // The capture node is shared, each route keeps its own names
+    match_result m = match(router, "/shops/north/items/12");
+    CHECK(m.controller == &item);
+    CHECK_EQ(m.params["shop"], "north");
+    CHECK_EQ(m.params["item"], "12");
+    CHECK_EQ(m.params.size(), 2u);
+
+    m = match(router, "/shops/north/about");
+    CHECK(m.controller == &other);
+    CHECK_EQ(m.params["name"], "north");
+    CHECK_EQ(m.params.size(), 1u);
+}
+
+static void overlapping_static_and_captures() {
+    // A static segment and a capture side by side at every depth, the lookup follows both at once
+    Controller captures("a/:x/a/:y/a/:z");
+    Controller statics("a/a/a/a");
+    Controller mixed("a/:w/a/a/a");
+    Router router;
+    router.add(captures.get_route(), &captures);
+    router.add(statics.get_route(), &statics);
+    router.add(mixed.get_route(), &mixed);
+
+    match_result m = match(router, "/a/a/a/a");
+    CHECK(m.controller == &statics);
+    CHECK(m.params.empty());
+
+    m = match(router, "/a/a/a/a/a");
+    CHECK(m.controller == &mixed);
+    CHECK_EQ(m.params["w"], "a");
+    CHECK_EQ(m.params.size(), 1u);
+
+    m = match(router, "/a/a/a/a/a/a");
+    CHECK(m.controller == &captures);
+    CHECK_EQ(m.params["x"], "a");
+    CHECK_EQ(m.params["y"], "a");
+    CHECK_EQ(m.params["z"], "a");
+
+    // Past the end of every route the deepest one reached keeps the request
+    m = match(router, "/a/b/a/c/a/d/a/a");
+    CHECK(m.controller == &captures);
+    CHECK_EQ(m.params["x"], "b");
+    CHECK_EQ(m.params["y"], "c");
+    CHECK_EQ(m.params["z"], "d");
+    CHECK(match(router, "/a/b/a/c").controller == nullptr);
+}
+
+static void replaced_and_cleared() {
+    Controller first("users");
+    Controller second("users");
+    Router router;
+    router.add(first.get_route(), &first);
+    router.add(second.get_route(), &second);
+    CHECK(match(router, "/users").controller == &second);
+
+    router.clear();
+    CHECK(match(router, "/users").controller == nullptr);
+}
+
+int main() {
+    static_over_capture();
+    deeper_capture_over_static();
+    first_static_segment_wins();
+    subtrees_and_misses();
+    captures_with_several_names();
+    overlapping_static_and_captures();
+    replaced_and_cleared();
+    return check_result("router_test");
+}